@@ -9,256 +9,5821 @@
 #include <GLFW/glfw3.h>
 
 #include <vector>
+#include <string>
 #include <cstdlib>
 #include <ctime>
 #include <cmath>
+#include <cstring>
+#include <cstdint>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef JIGSAW_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <dlfcn.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+typedef void (APIENTRYP PFNGLTEXSTORAGE2DPROC)(GLenum target, GLsizei levels, GLenum internalformat,
+                                               GLsizei width, GLsizei height);
 
 int WINDOW_W = 1280;
 int WINDOW_H = 720;
 int GRID = 3;
 
-const float SNAP_BASE = 0.09f;
-const float SNAP_FACTOR = 1.6f;
+const float SNAP_BASE = 0.09f;
+const float SNAP_FACTOR = 1.6f;
+// the solved picture spans [-BOARD_HALF, BOARD_HALF] on both axes
+const float BOARD_HALF = 0.5f;
+// --boards: puzzles are laid out on a grid this far apart, each centred on
+// its own solved picture
+const float BOARD_SPACING = 2.0f;
+// loose pieces are scattered this far from their board's centre
+const float SCATTER_HALF = 0.85f;
+// tween lengths in seconds: a snap into place, a scatter (plus up to
+// SCATTER_JITTER so a board doesn't move in lockstep) and a piece dropped
+// out of view going back to where it was picked up
+const float SNAP_TIME = 0.12f;
+const float SCATTER_TIME = 0.6f;
+const float SCATTER_JITTER = 0.3f;
+const float RETURN_TIME = 0.3f;
+// tweens catch up at most this much time after a stall
+const double TWEEN_MAX_CATCHUP = 0.25;
+
+// `size` is half the cell, used for picking and snapping; the drawn quad and
+// its UVs (u0..v1) are padded to `extent` so tabs fit, and `shape` picks the
+// outline from the mask atlas. `id` is the cell index, which names its mesh.
+// `depth` is the stacking key: higher is on top. `tween` is the slot of its
+// running tween, or -1
+struct PuzzlePiece {
+    float x, y;
+    float size;
+    float extent;
+    float u0, v0;
+    float u1, v1;
+    float tx, ty;
+    bool snapped;
+    int tile;
+    float tu0, tv0, tu1, tv1;
+    int shape;
+    int id;
+    int board;
+    uint32_t depth;
+    int tween;
+};
+
+// raising a piece hands it the next key; keys go to the depth buffer in
+// steps a 24-bit buffer resolves, and are renumbered when they run out
+const uint32_t DEPTH_KEYS = 1u << 22;
+// which fragments of a masked piece a pass keeps: all of them, blended; the
+// fully covered ones, which write depth; or the anti-aliased rim
+enum Coverage { COVER_ALL, COVER_OPAQUE, COVER_RIM };
+// piece quads must cover the box around them this many times over, and be
+// this big on average, before depth testing saves more shading than the
+// extra rim pass costs
+const float STACK_OVERDRAW = 6.0f;
+const float STACK_QUAD_PIXELS = 256.0f;
+
+// per-instance data for the unit quad: board-space rect, its UV rect, the
+// texture unit it samples, its depth and the part of the mask atlas that
+// cuts it out
+struct PieceInstance {
+    float x0, y0, x1, y1;
+    float u0, v0, u1, v1;
+    float unit, depth;
+    float mu0, mv0, mu1, mv1;
+};
+
+// piece outlines: every edge is flat, a tab or a blank, so 3^4 shapes cover
+// any puzzle. Each is a signed distance field on a padded square, baked into
+// one atlas on the worker pool; the fragment shader anti-aliases along it
+const float PIECE_PAD = 0.25f;
+const float TAB_RADIUS = 0.13f;
+const float TAB_OFFSET = 0.09f;
+const int MASK_SIZE = 64;
+const int MASK_GRID = 9;
+const int MASK_SHAPES = MASK_GRID * MASK_GRID;
+const float MASK_SPREAD = 0.1f;
+// the middle of the all-flat shape, for quads that shouldn't be masked
+const float MASK_SOLID = 0.5f / MASK_GRID;
+enum EdgeKind { EDGE_FLAT, EDGE_TAB, EDGE_BLANK };
+
+// mesh outlines (--mesh-pieces): an inner edge is three cubic Beziers, a
+// shoulder, the tab and a shoulder, that both neighbours evaluate from the
+// same seed. Every edge adds the region between it and the piece centre,
+// ear-clipped at MESH_LODS densities over one shared set of vertices
+const int MESH_LODS = 4;
+const int MESH_SAMPLES = 1 << (MESH_LODS - 1);
+const int MESH_EDGE_POINTS = 3 * MESH_SAMPLES;
+const int MESH_MAX_VERTS = 1 + 4 * MESH_EDGE_POINTS;
+// level l has at most 3 << l triangles per edge
+const int MESH_MAX_INDICES = 36 * ((1 << MESH_LODS) - 1);
+const float MESH_LOD_PIXELS[MESH_LODS - 1] = {24.0f, 48.0f, 96.0f};
+const float MESH_TAB = 0.085f;
+const float MESH_JITTER = 0.025f;
+const int MESH_TABLE_UNIT = 16;
+
+struct MeshVertex {
+    float x, y;
+    float piece;
+};
+
+// a piece's table entry, three RGBA32F texels: rect, UV rect, unit and depth
+struct MeshInstance {
+    float x0, y0, x1, y1;
+    float u0, v0, u1, v1;
+    float unit, depth, pad[2];
+};
+
+// MESH_MAX_VERTS vertices and MESH_MAX_INDICES indices per piece, so a
+// piece's block is found from its id; `counts` has each level's index count
+struct PieceMeshes {
+    std::vector<MeshVertex> vertices;
+    std::vector<uint16_t> indices;
+    std::vector<uint16_t> counts;
+    unsigned long version;
+};
+
+// ring of per-frame slots for dynamic vertex data, each slot guarded by a fence;
+// in orphan mode the storage is re-specified every frame instead
+const int STREAM_SLOTS = 3;
+const size_t STREAM_SLOT_BYTES = 64 * 1024;
+const size_t STREAM_ALIGN = 256;
+const int STREAM_PROBE_FRAMES = 120;
+const double STREAM_SLOW_MAP = 0.25e-3;
+
+struct StreamBuffer {
+    GLuint buffer;
+    size_t slotSize;
+    size_t used;
+    int slot;
+    bool orphan;
+    GLsync fences[STREAM_SLOTS];
+    unsigned long frames;
+    unsigned long waits;
+    unsigned long maps;
+    double mapSeconds;
+    // where a failed map's data waits for glBufferSubData at unmap, if it did
+    std::vector<unsigned char> fallback;
+    size_t fallbackOffset;
+    unsigned long failedMaps;
+};
+
+const int BENCH_FRAMES = 120;
+
+// the decoded image is kept while its rows are streamed through a PBO, a band
+// per frame, so a huge photo doesn't stall the first frame
+const size_t UPLOAD_BAND_BYTES = 4 * 1024 * 1024;
+
+enum TextureCompression { COMPRESS_NONE, COMPRESS_BC1, COMPRESS_BC7 };
+
+// persistent threads for CPU-heavy work; parallelFor also runs on the caller
+struct WorkerPool {
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit;
+};
+
+// pictures larger than GL_MAX_TEXTURE_SIZE (or --max-texture) are split into
+// tiles, one texture unit each; the mask atlas and the board layer sit on the
+// two units after them
+const int TILE_UNITS = 14;
+const int MASK_UNIT = TILE_UNITS;
+const int LAYER_UNIT = TILE_UNITS + 1;
+
+// with several boards every picture is a layer of one array texture, so
+// all boards still go out in one instanced draw; an instance unit of
+// PICTURE_LAYER_BASE + n samples layer n. There are no tiles then, so the
+// array takes the first tile unit
+const int PICTURE_ARRAY_UNIT = 0;
+const int PICTURE_LAYER_BASE = 32;
+const int PICTURE_LAYER_MAX = 2048;
+
+struct Board {
+    std::string image;
+    float x, y;
+    int layer;
+    unsigned long instances;
+};
+
+struct ImageTile {
+    GLuint texture;
+    int x, y, w, h;
+    int levels;
+    float u0, v0, u1, v1;
+};
+
+struct TextureUpload {
+    unsigned char* pixels;
+    int w, h;
+    int tile;
+    int nextRow;
+    int frames;
+    GLuint pbo;
+    double started;
+};
+
+// --virtual: the picture is kept on disk as a mip pyramid of fixed-size pages
+// (with a border for filtering) and only the pages visible pieces need are
+// resident in a cache texture; a page table maps each page to its cache slot
+// or to the nearest resident coarser page
+const int VT_PAGE = 128;
+const int VT_BORDER = 4;
+const int VT_CONTENT = VT_PAGE - 2 * VT_BORDER;
+const size_t VT_PAGE_BYTES = (size_t)VT_PAGE * VT_PAGE * 4;
+const int VT_CACHE_PAGES = 16;
+const int VT_SLOTS = VT_CACHE_PAGES * VT_CACHE_PAGES;
+const int VT_CACHE_UNIT = 0;
+const int VT_TABLE_UNIT = 1;
+const int VT_UPLOADS_PER_FRAME = 16;
+const int VT_MAX_INFLIGHT = 32;
+const uint32_t VT_PAGE_FILE_MAGIC = 0x5650544a; // "JTPV"
+const uint32_t VT_NO_PAGE = 0xffffffff;
+
+struct VirtualLevel {
+    int w, h;
+    int pagesX, pagesY;
+    uint32_t first;
+};
+
+struct LoadedPage {
+    uint32_t page;
+    std::vector<unsigned char> pixels;
+};
+
+struct VirtualTexture {
+    bool active;
+    int fd;
+    size_t dataOffset;
+    int w, h;
+    std::vector<VirtualLevel> levels;
+    std::vector<uint32_t> fileSlot;
+    std::vector<int> cacheSlot;
+    std::vector<unsigned long> requested;
+    std::vector<bool> loading;
+    std::vector<uint32_t> slotPage;
+    std::vector<unsigned long> slotUsed;
+    std::vector<std::vector<unsigned char>> table;
+    int tableW, tableH;
+    bool tableDirty;
+    GLuint cache, tableTex;
+    unsigned long frame, stamp;
+    int inflight;
+    std::mutex mutex;
+    std::vector<LoadedPage> ready;
+    unsigned long faults, loads, evictions;
+    size_t bytesStreamed;
+    double started;
+};
+
+// --on-demand: sleep in glfwWaitEventsTimeout and only redraw a dirty board
+const double IDLE_WAIT = 0.5;
+const double UNFOCUSED_WAIT = 2.0;
+const double UNFOCUSED_FRAME_INTERVAL = 0.1;
+
+std::vector<PuzzlePiece> pieces;
+std::vector<ImageTile> tiles;
+int maxTextureSize = 8192;
+GLuint vao = 0, vbo = 0, ebo = 0;
+GLuint texShader = 0;
+GLint texShaderXform = -1;
+GLint texShaderOffset = -1;
+GLint texShaderCoverage = -1;
+GLuint overlayShader = 0;
+GLint overlayXform = -1;
+GLint overlayColor = -1;
+StreamBuffer stream = {};
+TextureUpload upload = {};
+bool syncUpload = false;
+bool cpuMips = false;
+TextureCompression compression = COMPRESS_NONE;
+WorkerPool pool;
+bool virtualTexture = false;
+VirtualTexture vt;
+PFNGLTEXSTORAGE2DPROC texStorage2D = NULL;
+GLuint maskAtlas = 0;
+std::vector<uint8_t> maskTexels;
+bool meshPieces = false;
+PieceMeshes meshes = {};
+unsigned long meshVersion = 0, meshUploaded = 0;
+GLuint meshVao = 0, meshVbo = 0, meshEbo = 0, meshTable = 0;
+GLint texShaderMeshes = -1;
+GLint texShaderMeshBase = -1;
+unsigned long meshLodFrames[MESH_LODS] = {};
+int boardCount = 1;
+std::vector<Board> boards;
+GLuint pictureArray = 0;
+int pictureW = 0, pictureH = 0, pictureLayers = 0;
+
+// snapped pieces never move again, so they are baked into a render target as
+// they snap and drawn back as a single quad. The layer covers the boards in
+// world space at the screen's density for the zoom rounded up to a power of
+// two, so panning keeps it; it is rebuilt on resize, reload or a zoom past
+// that power. Zoomed in so far that it would outgrow BOARD_LAYER_MAX, the
+// snapped pieces left on screen are few and drawn directly instead
+const int BOARD_LAYER_MAX = 4096;
+GLuint boardFbo = 0, boardTex = 0;
+int boardW = 0, boardH = 0;
+bool boardValid = false;
+bool boardDirect = false;
+int boardSnapped = 0;
+std::vector<PuzzlePiece> boardQueue;
+unsigned long snapCount = 0;
+
+// --minimap: the whole table in a corner, kept in a layer of its own. Moves,
+// snaps and raises mark world rects dirty and only those are redrawn; the
+// layer is rebuilt when the board is replaced or the window resized
+const int MINIMAP_SIZE = 256;
+const float MINIMAP_MARGIN = 12.0f;
+const size_t MINIMAP_MAX_RECTS = 16;
+
+struct MapRect {
+    float x0, y0, x1, y1;
+};
+
+struct Minimap {
+    GLuint fbo, texture;
+    int side, w, h;
+    float x0, y0, x1, y1;
+    unsigned long generation;
+    unsigned long refreshes, updates, rects, pieces;
+};
+
+bool minimapEnabled = false;
+Minimap minimap = {};
+std::vector<MapRect> mapDirty;
+// bumped whenever `pieces` is replaced as a whole
+unsigned long boardGeneration = 0;
+
+bool prevMouseDown = false;
+bool mouseDown = false;
+int dragged = -1;
+float pickupX = 0.0f, pickupY = 0.0f;
+// the last stacking key handed out, and a count of restacks so the draw
+// order is only sorted again after one
+uint32_t depthCounter = 0;
+unsigned long stackVersion = 0;
+// frames drawn blended / depth tested, and their summed overdraw estimate
+unsigned long stackFrames[2] = {};
+double stackOverdraw = 0.0;
+float grabOffsetX = 0.0f;
+float grabOffsetY = 0.0f;
+bool benchRequested = false;
+bool scatterRequested = false;
+
+// --low-latency draws the dragged piece last and moves it to a cursor sample
+// taken right before that draw, through the offset uniform; --frame-delay
+// also sleeps after the swap so the next frame reads input as late as its
+// measured cost allows. Input-to-swap latency of drag frames is kept either way
+const double FRAME_DELAY_MARGIN = 0.002;
+const float FRAME_DELAY_SMOOTHING = 0.1f;
+
+bool lowLatency = false;
+bool frameDelay = false;
+double dragSampleTime = 0.0;
+
+// drag latencies go into fixed 0.1 ms buckets, the last one open ended, so a
+// long session costs no more memory than a short one
+const double LATENCY_BUCKET_MS = 0.1;
+const int LATENCY_BUCKETS = 1000;
+
+struct LatencyHistogram {
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long samples;
+    double sum;
+};
+
+LatencyHistogram dragLatency = {};
+
+struct FrameDelay {
+    double lastSwap;
+    double refresh;
+    double work;
+};
+
+FrameDelay delay = {};
+
+// frame pacing: --vsync picks the swap interval (adaptive tears late frames
+// instead of waiting a whole refresh), --fps-cap holds frames to a fixed
+// period by sleeping most of the way and spinning the rest. The spin starts
+// early by the worst recent oversleep, so the scheduler's wakeup jitter
+// doesn't reach the frame time
+enum VsyncMode { VSYNC_ON, VSYNC_OFF, VSYNC_ADAPTIVE };
+const double PACE_SPIN = 0.0003;
+const double PACE_TOLERANCE = 0.0002;
+const float PACE_OVERSHOOT_DECAY = 0.05f;
+// longer oversleeps are preemption rather than timer slack; spinning for
+// them would burn a core on every frame
+const double PACE_OVERSHOOT_MAX = 0.002;
+// intervals longer than this are idle gaps, not frames
+const double PACE_GAP = 0.25;
+
+struct FramePacer {
+    double interval;
+    double deadline;
+    double overshoot;
+    double last;
+    unsigned long frames;
+    unsigned long onTarget;
+    unsigned long missed;
+    double sum, sumSq;
+};
+
+VsyncMode vsync = VSYNC_ON;
+FramePacer pacer = {};
+
+// P toggles an overlay with per-section frame times; --profile-json prints the
+// same numbers every PROFILE_FRAMES frames. GPU sections use GL_TIME_ELAPSED
+// queries in two sets, read a frame late so they never stall
+const int PROFILE_FRAMES = 120;
+
+enum ProfileSection {
+    PROF_INPUT, PROF_HIT_TEST, PROF_UPLOAD, PROF_RENDER, PROF_SWAP,
+    PROF_GPU_CLEAR, PROF_GPU_PIECES, PROF_GPU_SWAP, PROF_SECTIONS
+};
+const int PROF_FIRST_GPU = PROF_GPU_CLEAR;
+const int PROF_GPU_SECTIONS = PROF_SECTIONS - PROF_FIRST_GPU;
+const char* PROFILE_NAMES[PROF_SECTIONS] = {
+    "input", "hit_test", "upload", "render", "swap", "gpu_clear", "gpu_pieces", "gpu_swap"
+};
+const char* PROFILE_LABELS[PROF_SECTIONS] = {
+    "INPUT", "HIT TEST", "UPLOAD", "RENDER", "SWAP", "GPU CLEAR", "GPU PIECES", "GPU SWAP"
+};
+
+// input is timed on the main thread while --render-thread draws on another,
+// hence the atomic nanosecond counters
+struct Profiler {
+    std::atomic<bool> overlay;
+    bool json;
+    std::atomic<uint64_t> current[PROF_SECTIONS];
+    float history[PROF_SECTIONS][PROFILE_FRAMES];
+    unsigned long frames;
+    GLuint queries[2][PROF_GPU_SECTIONS];
+    bool issued[2][PROF_GPU_SECTIONS];
+    int set;
+    bool queryOpen;
+    unsigned long gpuMissed;
+};
+
+Profiler profiler;
+
+// 2D camera over the board: screen NDC = (world - center) * zoom; pieces
+// outside the visible world rect are culled before they reach the GPU
+const float ZOOM_MIN = 0.5f;
+const float ZOOM_MAX = 64.0f;
+const float ZOOM_STEP = 1.15f;
+
+struct Camera {
+    float x, y;
+    float zoom;
+};
+
+Camera camera = {0.0f, 0.0f, 1.0f};
+// lowered so every board fits when there are several
+float zoomMin = ZOOM_MIN;
+
+// everything a frame draws. Rendering on the main thread points it at the
+// live board; the render thread gets one from the latest published snapshot
+struct BoardView {
+    const std::vector<PuzzlePiece>* pieces;
+    Camera camera;
+    int width, height;
+    int dragged;
+    float grabOffsetX, grabOffsetY;
+    unsigned long snaps;
+    double inputTime;
+    unsigned long stack;
+    // minimap rects still to redraw; the renderer clears the list
+    std::vector<MapRect>* dirty;
+    unsigned long generation;
+};
+
+BoardView view = {};
+// frames the board layer's world rect; the layer is drawn as seen by it
+Camera bakedCamera = {};
+unsigned long bakedSnaps = 0;
+double cursorTime = 0.0;
+// the last cursor position and when it was read, for the render thread
+std::atomic<double> cursorX(0.0), cursorY(0.0), cursorStamp(0.0);
+
+// --render-thread: the GL context lives on a render thread and the main thread
+// publishes copies of the board through a lock-free triple buffer. `shared`
+// holds the index of the slot last handed over plus NEW when it hasn't been
+// picked up yet; each side swaps its own slot with it, so neither ever waits
+const double SIM_TICK = 1.0 / 240.0;
+const int SNAPSHOT_NEW = 4;
+
+struct BoardSnapshot {
+    std::vector<PuzzlePiece> pieces;
+    std::vector<MapRect> dirty;
+    BoardView view;
+    double published;
+};
+
+struct SnapshotBuffer {
+    BoardSnapshot slots[3];
+    std::atomic<int> shared{1};
+    int back = 0, front = 2;
+    bool ready;
+    unsigned long published, acquired;
+    double publishSeconds, acquireSeconds, ageSeconds;
+};
+
+bool renderThread = false;
+SnapshotBuffer snapshots;
+std::thread renderer;
+std::atomic<bool> rendererQuit(false);
+
+bool panning = false;
+float panAnchorX = 0.0f, panAnchorY = 0.0f;
+unsigned long piecesCulled = 0;
+
+bool onDemand = false;
+bool needsRedraw = true;
+bool windowFocused = true;
+bool windowIconified = false;
+double lastRenderTime = 0.0;
+unsigned long framesRendered = 0;
+unsigned long framesSkipped = 0;
+
+// --damage: the screen is only cleared and redrawn inside the box around the
+// pieces that moved, were raised or snapped since the last frame, grown by
+// the boxes of as many frames as the back buffer is behind (its buffer age).
+// Anything else that changes the picture, or an unknown age, redraws it all
+const int DAMAGE_HISTORY = 4;
+const float DAMAGE_PAD = 2.0f;
+
+struct PieceMark {
+    float x, y;
+    uint32_t depth;
+    bool snapped;
+};
+
+struct Damage {
+    std::vector<PieceMark> marks;
+    Camera camera;
+    int width, height;
+    unsigned long generation, vtLoads;
+    // pixel boxes (x0, y0, x1, y1 from the bottom left) of the last frames,
+    // newest first, and the one this frame redraws
+    int boxes[DAMAGE_HISTORY][4];
+    int history;
+    int box[4];
+    unsigned long frames, partial, unknownAge;
+    double area;
+};
+
+bool damageTracking = false;
+Damage damage = {};
+
+// --dynamic-res=MS draws the board into `fbo` at 50-100% of the window's size
+// in DYNRES_STEPS steps, picked from how long frames take against the target,
+// and stretches it to the window with one blit; the minimap and the profiler
+// overlay are drawn after it at full size
+const int DYNRES_STEPS = 20;
+const int DYNRES_SETTLE = 30;
+
+struct DynamicRes {
+    float target;
+    int level;
+    GLuint fbo, color, depth;
+    int w, h;
+    // the view's own size while the board is drawn smaller, else 0
+    int windowW, windowH;
+    // timestamps around the frame's GPU work, in two sets read a frame late,
+    // and the CPU time spent submitting each set's frame
+    GLuint queries[2][2];
+    bool issued[2];
+    float submitMs[2];
+    int set;
+    double started;
+    // a software GL renderer rasterizes after the timestamps are taken, so
+    // its frames are finished and timed on the CPU instead
+    bool cpuTimed;
+    float smoothed;
+    int samples;
+    unsigned long frames, changes, missed;
+    double levelSum, msSum;
+};
+
+DynamicRes dynres = {};
+
+float dynResScale()
+{
+    return (float)dynres.level / DYNRES_STEPS;
+}
+
+// --headless renders into screenFbo through a surfaceless EGL context instead
+// of a window; everything that would target the default framebuffer uses it
+bool headless = false;
+GLuint screenFbo = 0;
+GLuint screenColor = 0, screenDepth = 0;
+
+// --software draws every frame on the CPU (see swRenderBoard)
+bool softwareBackend = false;
+
+// GL state cache: remembers what is bound and which uniform values are set so
+// redundant calls never reach the driver; counters are reset every frame
+const int GLS_TEXTURE_UNITS = 16;
+const int GLS_TEXTURE_TARGETS = 3;
+const int GLS_BUFFER_TARGETS = 5;
+
+struct CachedUniform {
+    std::string name;
+    GLint location;
+    bool valid;
+    float value[4];
+};
+
+struct ProgramInfo {
+    GLuint id;
+    std::vector<CachedUniform> uniforms;
+};
+
+struct GLStats {
+    unsigned long issued;
+    unsigned long elided;
+    unsigned long draws;
+    size_t uploadBytes;
+};
+
+struct GLState {
+    GLuint program;
+    GLuint vao;
+    GLuint framebuffer;
+    int activeUnit;
+    // past the fragment units: the vertex stage's mesh table
+    GLuint textures[MESH_TABLE_UNIT + 1][GLS_TEXTURE_TARGETS];
+    GLuint buffers[GLS_BUFFER_TARGETS];
+    int viewport[4];
+    bool blend;
+    // zero-initialised like the rest, so kept inverted: depth writes start on
+    bool depthTest, depthReadOnly;
+};
+
+GLState gls = {};
+GLStats glStats = {}, glStatsFrame = {}, glStatsTotal = {};
+std::vector<ProgramInfo> programs;
+
+static bool glsIssue(bool changed)
+{
+    if (changed) glStats.issued++;
+    else glStats.elided++;
+    return changed;
+}
+
+static int glsTextureSlot(GLenum target)
+{
+    switch (target) {
+    case GL_TEXTURE_2D_ARRAY: return 1;
+    case GL_TEXTURE_BUFFER: return 2;
+    default: return 0;
+    }
+}
+
+static int glsBufferSlot(GLenum target)
+{
+    switch (target) {
+    case GL_ARRAY_BUFFER: return 0;
+    case GL_ELEMENT_ARRAY_BUFFER: return 1;
+    case GL_PIXEL_UNPACK_BUFFER: return 2;
+    case GL_PIXEL_PACK_BUFFER: return 3;
+    case GL_TEXTURE_BUFFER: return 4;
+    default: return -1;
+    }
+}
+
+void glsUseProgram(GLuint p)
+{
+    if (glsIssue(gls.program != p)) {
+        gls.program = p;
+        glUseProgram(p);
+    }
+}
+
+void glsBindVertexArray(GLuint v)
+{
+    if (glsIssue(gls.vao != v)) {
+        gls.vao = v;
+        // the element buffer binding is part of the VAO
+        gls.buffers[glsBufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = ~0u;
+        glBindVertexArray(v);
+    }
+}
+
+void glsBindFramebuffer(GLuint fb)
+{
+    if (glsIssue(gls.framebuffer != fb)) {
+        gls.framebuffer = fb;
+        glBindFramebuffer(GL_FRAMEBUFFER, fb);
+    }
+}
+
+void glsViewport(int x, int y, int w, int h)
+{
+    int* v = gls.viewport;
+    if (glsIssue(v[0] != x || v[1] != y || v[2] != w || v[3] != h)) {
+        v[0] = x; v[1] = y; v[2] = w; v[3] = h;
+        glViewport(x, y, w, h);
+    }
+}
+
+void glsBlend(bool on)
+{
+    if (glsIssue(gls.blend != on)) {
+        gls.blend = on;
+        if (on) glEnable(GL_BLEND);
+        else glDisable(GL_BLEND);
+    }
+}
+void glsDepthTest(bool on)
+{
+    if (glsIssue(gls.depthTest != on)) {
+        gls.depthTest = on;
+        if (on) glEnable(GL_DEPTH_TEST);
+        else glDisable(GL_DEPTH_TEST);
+    }
+}
+void glsDepthMask(bool on)
+{
+    if (glsIssue(gls.depthReadOnly == on)) {
+        gls.depthReadOnly = !on;
+        glDepthMask(on ? GL_TRUE : GL_FALSE);
+    }
+}
+
+void glsActiveTexture(GLenum unit)
+{
+    if (glsIssue(gls.activeUnit != (int)(unit - GL_TEXTURE0))) {
+        gls.activeUnit = unit - GL_TEXTURE0;
+        glActiveTexture(unit);
+    }
+}
+
+void glsBindTexture(GLenum target, GLuint t)
+{
+    GLuint &cur = gls.textures[gls.activeUnit][glsTextureSlot(target)];
+    if (glsIssue(cur != t)) {
+        cur = t;
+        glBindTexture(target, t);
+    }
+}
+
+void glsBindBuffer(GLenum target, GLuint b)
+{
+    int slot = glsBufferSlot(target);
+    if (slot < 0) {
+        glsIssue(true);
+        glBindBuffer(target, b);
+        return;
+    }
+    if (glsIssue(gls.buffers[slot] != b)) {
+        gls.buffers[slot] = b;
+        glBindBuffer(target, b);
+    }
+}
+
+void glsBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    glsIssue(true);
+    if (data) glStats.uploadBytes += size;
+    glBufferData(target, size, data, usage);
+}
+
+void glsCountUpload(size_t bytes)
+{
+    glStats.uploadBytes += bytes;
+}
+
+void glsCountDraw()
+{
+    glStats.draws++;
+}
+
+// GL unbinds deleted objects, so the cache has to forget them too
+void glsDeleteTexture(GLuint t)
+{
+    for (auto &unit : gls.textures)
+        for (GLuint &b : unit)
+            if (b == t) b = 0;
+    glDeleteTextures(1, &t);
+}
+
+void glsDeleteBuffer(GLuint b)
+{
+    for (GLuint &cur : gls.buffers)
+        if (cur == b) cur = 0;
+    glDeleteBuffers(1, &b);
+}
+
+void glsRegisterProgram(GLuint p)
+{
+    ProgramInfo info;
+    info.id = p;
+    GLint count = 0;
+    glGetProgramiv(p, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        char name[256];
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(p, i, sizeof(name), NULL, &size, &type, name);
+        info.uniforms.push_back({name, glGetUniformLocation(p, name), false, {0, 0, 0, 0}});
+    }
+    programs.push_back(info);
+}
+
+static CachedUniform* glsFindUniform(GLuint p, GLint loc)
+{
+    for (auto &info : programs) {
+        if (info.id != p) continue;
+        for (auto &u : info.uniforms)
+            if (u.location == loc) return &u;
+    }
+    return NULL;
+}
+
+// resolved once at link time by glsRegisterProgram
+GLint uniformLocation(GLuint p, const char* name)
+{
+    for (auto &info : programs) {
+        if (info.id != p) continue;
+        for (auto &u : info.uniforms)
+            if (u.name == name) return u.location;
+    }
+    return -1;
+}
+
+void glsUniform4f(GLint loc, float x, float y, float z, float w)
+{
+    if (loc < 0) return;
+    CachedUniform* u = glsFindUniform(gls.program, loc);
+    bool changed = !u || !u->valid || u->value[0] != x || u->value[1] != y ||
+                   u->value[2] != z || u->value[3] != w;
+    if (glsIssue(changed)) {
+        if (u) {
+            u->valid = true;
+            u->value[0] = x; u->value[1] = y; u->value[2] = z; u->value[3] = w;
+        }
+        glUniform4f(loc, x, y, z, w);
+    }
+}
+
+void glsUniform1i(GLint loc, int v)
+{
+    if (loc < 0) return;
+    CachedUniform* u = glsFindUniform(gls.program, loc);
+    if (glsIssue(!u || !u->valid || u->value[0] != (float)v)) {
+        if (u) {
+            u->valid = true;
+            u->value[0] = (float)v;
+        }
+        glUniform1i(loc, v);
+    }
+}
+
+void glsEndFrame()
+{
+    glStatsFrame = glStats;
+    glStatsTotal.issued += glStats.issued;
+    glStatsTotal.elided += glStats.elided;
+    glStatsTotal.draws += glStats.draws;
+    glStatsTotal.uploadBytes += glStats.uploadBytes;
+    glStats = {};
+}
+
+void printGLStats(unsigned long frames)
+{
+    if (frames == 0) return;
+    printf("gl: %.1f calls issued, %.1f elided, %.1f draws, %.1f KB uploaded per frame\n",
+           (double)glStatsTotal.issued / frames, (double)glStatsTotal.elided / frames,
+           (double)glStatsTotal.draws / frames, glStatsTotal.uploadBytes / 1024.0 / frames);
+}
+
+BoardView liveView()
+{
+    return {&pieces, camera, WINDOW_W, WINDOW_H, dragged, grabOffsetX, grabOffsetY, snapCount, cursorTime,
+            stackVersion, &mapDirty, boardGeneration};
+}
+
+void screenToWorld(const BoardView& v, double mx, double my, float& wx, float& wy)
+{
+    wx = (float)((mx / v.width) * 2.0 - 1.0) / v.camera.zoom + v.camera.x;
+    wy = (float)(1.0 - (my / v.height) * 2.0) / v.camera.zoom + v.camera.y;
+}
+
+// the world rect of the view being drawn
+void visibleRect(float& x0, float& y0, float& x1, float& y1)
+{
+    x0 = view.camera.x - 1.0f / view.camera.zoom;
+    x1 = view.camera.x + 1.0f / view.camera.zoom;
+    y0 = view.camera.y - 1.0f / view.camera.zoom;
+    y1 = view.camera.y + 1.0f / view.camera.zoom;
+}
+
+bool pieceVisible(const PuzzlePiece& p, float x0, float y0, float x1, float y1)
+{
+    return p.x + p.extent > x0 && p.x - p.extent < x1 && p.y + p.extent > y0 && p.y - p.extent < y1;
+}
+
+float pieceDepth(const PuzzlePiece& p)
+{
+    return (float)p.depth / DEPTH_KEYS;
+}
+
+// indices of the viewed pieces from the top of the stack down
+const std::vector<int>& stackOrder()
+{
+    static std::vector<int> order;
+    static unsigned long sorted = ~0ul;
+    const std::vector<PuzzlePiece> &src = *view.pieces;
+    if (sorted != view.stack || order.size() != src.size()) {
+        order.resize(src.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = (int)i;
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return src[a].depth > src[b].depth; });
+        sorted = view.stack;
+    }
+    return order;
+}
+
+// pieces of the live stack are visited in stacking order, top down or
+// bottom up; the rest in vector order
+template <class F> void forEachPiece(const std::vector<PuzzlePiece>& src, bool snapped, bool topDown, F visit)
+{
+    if (!snapped && &src == view.pieces) {
+        const std::vector<int> &order = stackOrder();
+        for (size_t k = 0; k < order.size(); ++k) {
+            const PuzzlePiece &p = src[order[topDown ? k : order.size() - 1 - k]];
+            if (!p.snapped) visit(p);
+        }
+        return;
+    }
+    for (auto &p : src)
+        if (p.snapped == snapped) visit(p);
+}
+
+// GLFW's timer isn't available without a window
+double now()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// the board layer notices a new zoom level itself when it is next updated
+void cameraMoved()
+{
+    needsRedraw = true;
+}
+
+static void framebuffer_size_callback(GLFWwindow* window UNUSED, int width, int height)
+{
+    WINDOW_W = width;
+    WINDOW_H = height;
+    needsRedraw = true;
+}
+
+static void window_refresh_callback(GLFWwindow* window UNUSED)
+{
+    needsRedraw = true;
+}
+
+static void window_focus_callback(GLFWwindow* window UNUSED, int focused)
+{
+    windowFocused = focused;
+    needsRedraw = true;
+}
+
+static void window_iconify_callback(GLFWwindow* window UNUSED, int iconified)
+{
+    windowIconified = iconified;
+    needsRedraw = true;
+}
+
+static void cursor_pos_callback(GLFWwindow* window UNUSED, double x, double y)
+{
+    cursorStamp = now();
+    cursorX = x;
+    cursorY = y;
+    if (dragged != -1 || panning) needsRedraw = true;
+}
+
+// zooms about the cursor, so the point under it stays put
+static void scroll_callback(GLFWwindow* window, double dx UNUSED, double dy)
+{
+    double mx, my;
+    glfwGetCursorPos(window, &mx, &my);
+    float wx, wy;
+    screenToWorld(liveView(), mx, my, wx, wy);
+    float zoom = fminf(fmaxf(camera.zoom * powf(ZOOM_STEP, (float)dy), zoomMin), ZOOM_MAX);
+    if (zoom == camera.zoom) return;
+    camera.x = wx - (wx - camera.x) * camera.zoom / zoom;
+    camera.y = wy - (wy - camera.y) * camera.zoom / zoom;
+    camera.zoom = zoom;
+    cameraMoved();
+}
+
+static void mouse_button_callback(GLFWwindow* window UNUSED, int button UNUSED, int action UNUSED,
+                                  int mods UNUSED)
+{
+    needsRedraw = true;
+}
+
+static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        benchRequested = true;
+        needsRedraw = true;
+    }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        profiler.overlay = !profiler.overlay.load();
+        needsRedraw = true;
+    }
+    if (key == GLFW_KEY_S && action == GLFW_PRESS) scatterRequested = true;
+}
+
+void* glProc(const char* name)
+{
+#ifdef JIGSAW_HEADLESS
+    if (headless) return (void*)eglGetProcAddress(name);
+#endif
+    return (void*)glfwGetProcAddress(name);
+}
+
+bool hasGLExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+        if (!strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name)) return true;
+    return false;
+}
+
+// $XDG_CACHE_HOME/jigsaw or ~/.cache/jigsaw, created on first use; empty if unavailable
+std::string cacheDir()
+{
+    static std::string dir;
+    static bool done = false;
+    if (done) return dir;
+    done = true;
+
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    std::string base;
+    if (xdg && *xdg) base = xdg;
+    else if (home && *home) base = std::string(home) + "/.cache";
+    else return dir;
+
+    mkdir(base.c_str(), 0755);
+    std::string d = base + "/jigsaw";
+    mkdir(d.c_str(), 0755);
+    struct stat st;
+    if (stat(d.c_str(), &st) == 0 && (st.st_mode & S_IFDIR)) dir = d;
+    return dir;
+}
+
+// bytes between the read position and the end of `fp`, for checking a length
+// read from a cache header before it sizes a buffer
+size_t bytesLeft(FILE* fp)
+{
+    long pos = ftell(fp);
+    if (pos < 0 || fseek(fp, 0, SEEK_END) != 0) return 0;
+    long end = ftell(fp);
+    fseek(fp, pos, SEEK_SET);
+    return end > pos ? (size_t)(end - pos) : 0;
+}
+
+// writes a header and body through a temp file and renames it into place, so
+// an interrupted write or a second instance never leaves a torn cache entry
+void writeCacheFile(const std::string& path, const void* hdr, size_t hdrBytes, const void* data, size_t bytes)
+{
+    std::string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) return;
+    bool ok = fwrite(hdr, hdrBytes, 1, fp) == 1 && fwrite(data, 1, bytes, fp) == bytes;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) remove(tmp.c_str());
+}
+
+const uint64_t FNV_BASIS = 1469598103934665603ull;
+
+uint64_t fnv1a(const void* data, size_t n, uint64_t h = FNV_BASIS)
+{
+    const unsigned char* b = (const unsigned char*)data;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= b[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+uint64_t fnv1a(const char* str, uint64_t h)
+{
+    return fnv1a(str, strlen(str) + 1, h);
+}
+
+GLuint compile(GLenum type, const char* src)
+{
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, NULL);
+    glCompileShader(s);
+    return s;
+}
+
+void checkShader(GLuint s)
+{
+    GLint ok;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(s, 1024, NULL, log);
+        fprintf(stderr, "shader error: %s\n", log);
+    }
+}
+
+// programs are cached as glGetProgramBinary output keyed by the sources and the
+// driver; a binary the driver rejects is simply rebuilt from source
+const uint32_t PROGRAM_CACHE_MAGIC = 0x4250474a; // "JGPB"
+const uint32_t PROGRAM_CACHE_MAX = 64 << 20;
+
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t length;
+    float compileMs;
+};
+
+struct ProgramBuild {
+    const char* vs;
+    const char* fs;
+    GLuint program;
+    GLuint v, f;
+    uint64_t key;
+    bool cached;
+    float savedMs;
+    double started;
+};
+
+std::string programCachePath(uint64_t key)
+{
+    std::string dir = cacheDir();
+    if (dir.empty()) return dir;
+    char name[64];
+    snprintf(name, sizeof(name), "/program-%016llx.bin", (unsigned long long)key);
+    return dir + name;
+}
+
+bool loadProgramBinary(ProgramBuild& b)
+{
+    std::string path = programCachePath(b.key);
+    FILE* fp = path.empty() ? NULL : fopen(path.c_str(), "rb");
+    if (!fp) return false;
+
+    ProgramCacheHeader hdr;
+    std::vector<char> data;
+    bool ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == PROGRAM_CACHE_MAGIC &&
+              hdr.length > 0 && hdr.length <= PROGRAM_CACHE_MAX && hdr.length <= bytesLeft(fp);
+    if (ok) {
+        data.resize(hdr.length);
+        ok = fread(data.data(), 1, hdr.length, fp) == hdr.length;
+    }
+    fclose(fp);
+    if (!ok) return false;
+
+    double t0 = now();
+    GLuint p = glCreateProgram();
+    glProgramBinary(p, hdr.format, data.data(), (GLsizei)data.size());
+    GLint linked = 0;
+    glGetProgramiv(p, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glDeleteProgram(p);
+        return false;
+    }
+    b.program = p;
+    b.savedMs = hdr.compileMs - (float)((now() - t0) * 1000.0);
+    return true;
+}
+
+void saveProgramBinary(const ProgramBuild& b, float compileMs)
+{
+    std::string path = programCachePath(b.key);
+    if (path.empty()) return;
+
+    GLint len = 0;
+    glGetProgramiv(b.program, GL_PROGRAM_BINARY_LENGTH, &len);
+    if (len <= 0) return;
+    std::vector<char> data(len);
+    GLenum format;
+    glGetProgramBinary(b.program, len, &len, &format, data.data());
+
+    ProgramCacheHeader hdr = {PROGRAM_CACHE_MAGIC, format, (uint32_t)len, compileMs};
+    writeCacheFile(path, &hdr, sizeof(hdr), data.data(), len);
+}
+
+// turns on KHR/ARB_parallel_shader_compile so the driver compiles on its own threads
+bool enableParallelCompile()
+{
+    const char* fn = NULL;
+    if (hasGLExtension("GL_KHR_parallel_shader_compile")) fn = "glMaxShaderCompilerThreadsKHR";
+    else if (hasGLExtension("GL_ARB_parallel_shader_compile")) fn = "glMaxShaderCompilerThreadsARB";
+    if (!fn) return false;
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads =
+        (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glProc(fn);
+    if (!maxThreads) return false;
+    maxThreads(0xFFFFFFFFu);
+    return true;
+}
+
+// builds independent programs together: cached binaries are loaded first, the rest
+// are all submitted before any status is queried so the driver can overlap them
+void buildPrograms(ProgramBuild* builds, int n)
+{
+    double t0 = now();
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    uint64_t driver = fnv1a((const char*)glGetString(GL_VERSION), FNV_BASIS);
+    driver = fnv1a((const char*)glGetString(GL_RENDERER), driver);
+    bool parallel = enableParallelCompile();
+
+    int hits = 0;
+    float saved = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        ProgramBuild &b = builds[i];
+        b.key = fnv1a(b.fs, fnv1a(b.vs, driver));
+        b.cached = formats > 0 && loadProgramBinary(b);
+        if (b.cached) {
+            hits++;
+            saved += b.savedMs;
+            continue;
+        }
+        b.started = now();
+        b.v = compile(GL_VERTEX_SHADER, b.vs);
+        b.f = compile(GL_FRAGMENT_SHADER, b.fs);
+        b.program = glCreateProgram();
+        glAttachShader(b.program, b.v);
+        glAttachShader(b.program, b.f);
+        if (formats > 0) glProgramParameteri(b.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(b.program);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        ProgramBuild &b = builds[i];
+        if (!b.cached) {
+            // every program is needed now, so the blocking status queries wait
+            // for the driver's compile threads rather than a polling loop
+            checkShader(b.v);
+            checkShader(b.f);
+            GLint ok;
+            glGetProgramiv(b.program, GL_LINK_STATUS, &ok);
+            if (!ok) {
+                char log[1024];
+                glGetProgramInfoLog(b.program, 1024, NULL, log);
+                fprintf(stderr, "program link error: %s\n", log);
+            } else if (formats > 0) {
+                saveProgramBinary(b, (float)((now() - b.started) * 1000.0));
+            }
+            glDeleteShader(b.v);
+            glDeleteShader(b.f);
+        }
+        glsRegisterProgram(b.program);
+    }
+
+    printf("shaders: %d program(s), %d from cache, %.1f ms%s", n, hits,
+           (now() - t0) * 1000.0, parallel ? ", parallel compile" : "");
+    if (hits) printf(", saved ~%.1f ms", saved);
+    printf("\n");
+}
+
+GLuint makeProgram(const char* vs, const char* fs)
+{
+    ProgramBuild b = {};
+    b.vs = vs;
+    b.fs = fs;
+    buildPrograms(&b, 1);
+    return b.program;
+}
+
+void poolStart()
+{
+    if (!pool.threads.empty()) return;
+    // at least one, so background jobs make progress on a single core
+    int n = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    for (int i = 0; i < n; ++i) {
+        pool.threads.emplace_back([] {
+            for (;;) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(pool.mutex);
+                    pool.wake.wait(lock, [] { return pool.quit || !pool.jobs.empty(); });
+                    if (pool.quit && pool.jobs.empty()) return;
+                    job = std::move(pool.jobs.front());
+                    pool.jobs.pop_front();
+                }
+                job();
+            }
+        });
+    }
+}
+
+void poolSubmit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.jobs.push_back(std::move(job));
+    }
+    pool.wake.notify_one();
+}
+
+void poolStop()
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.quit = true;
+    }
+    pool.wake.notify_all();
+    for (auto &t : pool.threads) t.join();
+    pool.threads.clear();
+}
+
+// runs fn(i) for every i in [0, n); helpers that only get scheduled after the
+// work is gone find nothing left and never touch fn
+void parallelFor(int n, const std::function<void(int)>& fn)
+{
+    struct Shared {
+        std::atomic<int> next;
+        int active;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto shared = std::make_shared<Shared>();
+    shared->next = 0;
+    shared->active = 0;
+    const std::function<void(int)>* body = &fn;
+
+    auto work = [shared, body, n] {
+        {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->active++;
+        }
+        for (int i = shared->next++; i < n; i = shared->next++) (*body)(i);
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        if (--shared->active == 0) shared->done.notify_all();
+    };
+
+    poolStart();
+    for (size_t t = 0; t < pool.threads.size() && (int)t + 1 < n; ++t) poolSubmit(work);
+    work();
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->done.wait(lock, [&] { return shared->active == 0; });
+}
+
+int mipLevels(int w, int h)
+{
+    int levels = 1;
+    while (w > 1 || h > 1) {
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+        levels++;
+    }
+    return levels;
+}
+
+// 2x2 box filter of an RGBA8 image into (sw/2, sh/2), clamped to at least 1x1
+void downsample2x(const unsigned char* src, int sw, int sh, unsigned char* dst)
+{
+    int dw = sw > 1 ? sw / 2 : 1;
+    int dh = sh > 1 ? sh / 2 : 1;
+    int dx = sw > 1 ? 1 : 0;
+
+    for (int y = 0; y < dh; ++y) {
+        const unsigned char* r0 = src + (size_t)(sh > 1 ? 2 * y : y) * sw * 4;
+        const unsigned char* r1 = src + (size_t)(sh > 1 ? 2 * y + 1 : y) * sw * 4;
+        unsigned char* d = dst + (size_t)y * dw * 4;
+        int x = 0;
+        if (dx) {
+#if defined(__SSE2__)
+            for (; x + 4 <= dw; x += 4) {
+                __m128i a = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(r0 + x * 8)),
+                                         _mm_loadu_si128((const __m128i*)(r1 + x * 8)));
+                __m128i b = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(r0 + x * 8 + 16)),
+                                         _mm_loadu_si128((const __m128i*)(r1 + x * 8 + 16)));
+                __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0));
+                __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1));
+                _mm_storeu_si128((__m128i*)(d + x * 4), _mm_avg_epu8(_mm_castps_si128(even), _mm_castps_si128(odd)));
+            }
+#elif defined(__ARM_NEON)
+            for (; x + 4 <= dw; x += 4) {
+                uint32x4x2_t a = vld2q_u32((const uint32_t*)(r0 + x * 8));
+                uint32x4x2_t b = vld2q_u32((const uint32_t*)(r1 + x * 8));
+                uint8x16_t top = vrhaddq_u8(vreinterpretq_u8_u32(a.val[0]), vreinterpretq_u8_u32(a.val[1]));
+                uint8x16_t bot = vrhaddq_u8(vreinterpretq_u8_u32(b.val[0]), vreinterpretq_u8_u32(b.val[1]));
+                vst1q_u8(d + x * 4, vrhaddq_u8(top, bot));
+            }
+#endif
+        }
+        for (; x < dw; ++x) {
+            const unsigned char* a = r0 + (x << dx) * 4;
+            const unsigned char* b = r1 + (x << dx) * 4;
+            for (int c = 0; c < 4; ++c)
+                d[x * 4 + c] = (unsigned char)((a[c] + a[c + dx * 4] + b[c] + b[c + dx * 4] + 2) >> 2);
+        }
+    }
+}
+
+// RGBA8 image scaled to dw x dh: halves while that still leaves at least the
+// target size, then samples bilinearly; enough for bringing pictures to a
+// shared layer size
+std::vector<unsigned char> resizeImage(const unsigned char* src, int sw, int sh, int dw, int dh)
+{
+    std::vector<unsigned char> cur(src, src + (size_t)sw * sh * 4), half;
+    while (sw / 2 >= dw && sh / 2 >= dh) {
+        half.resize((size_t)(sw / 2) * (sh / 2) * 4);
+        downsample2x(cur.data(), sw, sh, half.data());
+        cur.swap(half);
+        sw /= 2;
+        sh /= 2;
+    }
+    if (sw == dw && sh == dh) return cur;
+
+    std::vector<unsigned char> out((size_t)dw * dh * 4);
+    parallelFor(dh, [&](int y) {
+        float fy = fminf(fmaxf((y + 0.5f) * sh / dh - 0.5f, 0.0f), (float)(sh - 1));
+        int y0 = (int)fy, y1 = std::min(y0 + 1, sh - 1);
+        float ty = fy - y0;
+        for (int x = 0; x < dw; ++x) {
+            float fx = fminf(fmaxf((x + 0.5f) * sw / dw - 0.5f, 0.0f), (float)(sw - 1));
+            int x0 = (int)fx, x1 = std::min(x0 + 1, sw - 1);
+            float tx = fx - x0;
+            const unsigned char* a = &cur[((size_t)y0 * sw + x0) * 4];
+            const unsigned char* b = &cur[((size_t)y0 * sw + x1) * 4];
+            const unsigned char* c = &cur[((size_t)y1 * sw + x0) * 4];
+            const unsigned char* d = &cur[((size_t)y1 * sw + x1) * 4];
+            unsigned char* o = &out[((size_t)y * dw + x) * 4];
+            for (int k = 0; k < 4; ++k) {
+                float top = a[k] + (b[k] - a[k]) * tx, bottom = c[k] + (d[k] - c[k]) * tx;
+                o[k] = (unsigned char)(top + (bottom - top) * ty + 0.5f);
+            }
+        }
+    });
+    return out;
+}
+
+// fills levels 1.. from level 0 on the CPU, for when the GPU can't generate them
+void uploadCpuMips(const unsigned char* pixels, int w, int h, int levels)
+{
+    std::vector<unsigned char> cur(pixels, pixels + (size_t)w * h * 4), next;
+    for (int level = 1; level < levels; ++level) {
+        int nw = w > 1 ? w / 2 : 1;
+        int nh = h > 1 ? h / 2 : 1;
+        next.resize((size_t)nw * nh * 4);
+        downsample2x(cur.data(), w, h, next.data());
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, nw, nh, GL_RGBA, GL_UNSIGNED_BYTE, next.data());
+        glsCountUpload(next.size());
+        cur.swap(next);
+        w = nw;
+        h = nh;
+    }
+}
+
+std::vector<unsigned char> tilePixels(const unsigned char* pixels, int stride, const ImageTile& t)
+{
+    std::vector<unsigned char> out((size_t)t.w * t.h * 4);
+    for (int y = 0; y < t.h; ++y)
+        memcpy(&out[(size_t)y * t.w * 4], pixels + ((size_t)(t.y + y) * stride + t.x) * 4, (size_t)t.w * 4);
+    return out;
+}
+
+void finishTile(const ImageTile& t)
+{
+    glsBindTexture(GL_TEXTURE_2D, t.texture);
+    // glGenerateMipmap only fills levels up to MAX_LEVEL
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, t.levels - 1);
+    if (cpuMips) uploadCpuMips(tilePixels(upload.pixels, upload.w, t).data(), t.w, t.h, t.levels);
+    else glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+void finishTextureUpload()
+{
+    printf("texture: %dx%d in %zu tile(s), uploaded over %d frame(s) in %.1f ms, %s mips\n",
+           upload.w, upload.h, tiles.size(), upload.frames,
+           (now() - upload.started) * 1000.0, cpuMips ? "CPU" : "GPU");
+
+    stbi_image_free(upload.pixels);
+    if (upload.pbo) glsDeleteBuffer(upload.pbo);
+    upload = {};
+}
+
+// copies the next band of rows of the current tile into the PBO and lets the
+// driver pull it into level 0
+void textureUploadStep()
+{
+    if (!upload.pixels) return;
+
+    const ImageTile &t = tiles[upload.tile];
+    size_t rowBytes = (size_t)t.w * 4;
+    int rows = (int)(UPLOAD_BAND_BYTES / rowBytes);
+    if (rows < 1) rows = 1;
+    if (rows > t.h - upload.nextRow) rows = t.h - upload.nextRow;
+    size_t bytes = rows * rowBytes;
+
+    glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.pbo);
+    glsBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    unsigned char* dst = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    const unsigned char* src = upload.pixels + ((size_t)(t.y + upload.nextRow) * upload.w + t.x) * 4;
+    glsCountUpload(bytes);
+    glsBindTexture(GL_TEXTURE_2D, t.texture);
+    if (dst) {
+        for (int r = 0; r < rows; ++r) memcpy(dst + r * rowBytes, src + (size_t)r * upload.w * 4, rowBytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.nextRow, t.w, rows, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+        glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        // the band goes straight from the decoded picture instead
+        static bool warned = false;
+        if (!warned) fprintf(stderr, "texture: glMapBufferRange failed (0x%x), uploading without the PBO\n", glGetError());
+        warned = true;
+        glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, upload.w);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.nextRow, t.w, rows, GL_RGBA, GL_UNSIGNED_BYTE, src);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+
+    upload.nextRow += rows;
+    upload.frames++;
+    if (upload.nextRow < t.h) return;
+    finishTile(t);
+    upload.nextRow = 0;
+    if (++upload.tile == (int)tiles.size()) finishTextureUpload();
+}
+
+int tileSize()
+{
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    return maxSize < maxTextureSize ? maxSize : maxTextureSize;
+}
+
+int tileCount(int w, int h)
+{
+    int ts = tileSize();
+    return ((w + ts - 1) / ts) * ((h + ts - 1) / ts);
+}
+
+// cuts a w x h picture into the tile grid and creates an empty texture per tile
+void planTiles(int w, int h)
+{
+    int ts = tileSize();
+    tiles.clear();
+    for (int y = 0; y < h; y += ts) {
+        for (int x = 0; x < w; x += ts) {
+            ImageTile t = {};
+            t.x = x;
+            t.y = y;
+            t.w = w - x < ts ? w - x : ts;
+            t.h = h - y < ts ? h - y : ts;
+            t.levels = mipLevels(t.w, t.h);
+            t.u0 = (float)x / w;
+            t.v0 = (float)y / h;
+            t.u1 = (float)(x + t.w) / w;
+            t.v1 = (float)(y + t.h) / h;
+            glGenTextures(1, &t.texture);
+            tiles.push_back(t);
+        }
+    }
+}
+
+void deleteTiles()
+{
+    for (auto &t : tiles) glsDeleteTexture(t.texture);
+    tiles.clear();
+}
+
+// stbi_load plus halving until the picture fits the tile units; the result is
+// released with stbi_image_free either way
+unsigned char* decodeImage(const char* path, int& w, int& h)
+{
+    int ch;
+    double t0 = now();
+    unsigned char* data = stbi_load(path, &w, &h, &ch, 4);
+    if (!data) {
+        fprintf(stderr, "Failed to load: %s (%s)\n", path, stbi_failure_reason());
+        return NULL;
+    }
+    printf("texture: decoded in %.1f ms\n", (now() - t0) * 1000.0);
+
+    while (tileCount(w, h) > TILE_UNITS) {
+        int nw = w / 2, nh = h / 2;
+        unsigned char* half = (unsigned char*)malloc((size_t)nw * nh * 4);
+        downsample2x(data, w, h, half);
+        stbi_image_free(data);
+        fprintf(stderr, "texture: %dx%d needs more than %d tiles, halved to %dx%d\n", w, h, TILE_UNITS, nw, nh);
+        data = half;
+        w = nw;
+        h = nh;
+    }
+    return data;
+}
+
+// block-compressed textures: levels are built on the CPU, encoded to BC1 or
+// BC7 (mode 6) across the worker pool and cached on disk per source file
+const uint32_t TEXTURE_CACHE_MAGIC = 0x5843544a; // "JTCX"
+
+struct TextureCacheHeader {
+    uint32_t magic;
+    uint32_t format;
+    int32_t w, h;
+    int32_t tiles;
+    uint32_t bytes;
+};
+
+size_t compressedSize(int w, int h, TextureCompression c)
+{
+    return (size_t)((w + 3) / 4) * ((h + 3) / 4) * (c == COMPRESS_BC1 ? 8 : 16);
+}
+
+// gathers a 4x4 block, clamping at the right and bottom edges
+static void fetchBlock(const unsigned char* pixels, int w, int h, int bx, int by, unsigned char block[64])
+{
+    for (int y = 0; y < 4; ++y) {
+        int sy = by * 4 + y < h ? by * 4 + y : h - 1;
+        for (int x = 0; x < 4; ++x) {
+            int sx = bx * 4 + x < w ? bx * 4 + x : w - 1;
+            memcpy(block + (y * 4 + x) * 4, pixels + ((size_t)sy * w + sx) * 4, 4);
+        }
+    }
+}
+
+// fits a line through the block's colors: the mean plus the principal axis
+// (power iteration on the covariance), then the extent of the projections
+static void fitLine(const unsigned char block[64], int channels, float e0[4], float e1[4])
+{
+    float mean[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < channels; ++c) mean[c] += block[i * 4 + c] / 16.0f;
+
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int a = 0; a < channels; ++a)
+            for (int b = 0; b < channels; ++b)
+                cov[a][b] += (block[i * 4 + a] - mean[a]) * (block[i * 4 + b] - mean[b]);
+
+    float axis[4] = {1, 1, 1, 1};
+    for (int it = 0; it < 8; ++it) {
+        float next[4] = {0, 0, 0, 0};
+        float len = 0.0f;
+        for (int a = 0; a < channels; ++a) {
+            for (int b = 0; b < channels; ++b) next[a] += cov[a][b] * axis[b];
+            len += next[a] * next[a];
+        }
+        if (len < 1e-8f) break;
+        len = 1.0f / sqrtf(len);
+        for (int a = 0; a < channels; ++a) axis[a] = next[a] * len;
+    }
+
+    float lo = 0.0f, hi = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; ++c) t += (block[i * 4 + c] - mean[c]) * axis[c];
+        lo = fminf(lo, t);
+        hi = fmaxf(hi, t);
+    }
+    for (int c = 0; c < 4; ++c) {
+        float m = c < channels ? mean[c] : 255.0f;
+        float a = c < channels ? axis[c] : 0.0f;
+        e0[c] = fminf(fmaxf(m + lo * a, 0.0f), 255.0f);
+        e1[c] = fminf(fmaxf(m + hi * a, 0.0f), 255.0f);
+    }
+}
+
+static int colorError(const unsigned char* a, const int* b, int channels)
+{
+    int err = 0;
+    for (int c = 0; c < channels; ++c) err += (a[c] - b[c]) * (a[c] - b[c]);
+    return err;
+}
+
+static uint16_t pack565(const float c[4])
+{
+    int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpack565(uint16_t v, int out[4])
+{
+    int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+    out[3] = 255;
+}
+
+void encodeBC1Block(const unsigned char block[64], unsigned char out[8])
+{
+    float e0[4], e1[4];
+    fitLine(block, 3, e0, e1);
+    uint16_t c0 = pack565(e1), c1 = pack565(e0);
+    if (c0 < c1) {
+        uint16_t t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+
+    int pal[4][4];
+    unpack565(c0, pal[0]);
+    unpack565(c1, pal[1]);
+    for (int c = 0; c < 4; ++c) {
+        pal[2][c] = (2 * pal[0][c] + pal[1][c]) / 3;
+        pal[3][c] = (pal[0][c] + 2 * pal[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestErr = colorError(block + i * 4, pal[0], 3);
+            for (int k = 1; k < 4; ++k) {
+                int err = colorError(block + i * 4, pal[k], 3);
+                if (err < bestErr) {
+                    best = k;
+                    bestErr = err;
+                }
+            }
+            indices |= (uint32_t)best << (i * 2);
+        }
+    }
+    out[0] = c0 & 0xff; out[1] = c0 >> 8;
+    out[2] = c1 & 0xff; out[3] = c1 >> 8;
+    memcpy(out + 4, &indices, 4);
+}
+
+static void putBits(unsigned char* out, int& pos, uint32_t v, int bits)
+{
+    for (int i = 0; i < bits; ++i, ++pos)
+        if ((v >> i) & 1) out[pos >> 3] |= (unsigned char)(1 << (pos & 7));
+}
+
+// 7-bit endpoint plus the p-bit that reconstructs it best
+static void quantizeBC7Endpoint(const float e[4], int q[4], int& p)
+{
+    int bestErr = -1;
+    for (int pb = 0; pb < 2; ++pb) {
+        int err = 0, cand[4];
+        for (int c = 0; c < 4; ++c) {
+            int v = (int)((e[c] - pb) / 2.0f + 0.5f);
+            cand[c] = v < 0 ? 0 : (v > 127 ? 127 : v);
+            int r = (cand[c] << 1) | pb;
+            err += (r - (int)e[c]) * (r - (int)e[c]);
+        }
+        if (bestErr < 0 || err < bestErr) {
+            bestErr = err;
+            p = pb;
+            memcpy(q, cand, sizeof(cand));
+        }
+    }
+}
+
+void encodeBC7Block(const unsigned char block[64], unsigned char out[16])
+{
+    static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    float e0[4], e1[4];
+    fitLine(block, 4, e0, e1);
+
+    int q0[4], q1[4], p0, p1;
+    quantizeBC7Endpoint(e0, q0, p0);
+    quantizeBC7Endpoint(e1, q1, p1);
+
+    // all 16 palette entries lie on one segment, so projecting onto it
+    // picks the nearest entry without a full palette search
+    float a[4], d[4], dd = 0.0f;
+    for (int c = 0; c < 4; ++c) {
+        a[c] = (float)((q0[c] << 1) | p0);
+        d[c] = (float)((q1[c] << 1) | p1) - a[c];
+        dd += d[c] * d[c];
+    }
+    int idx[16] = {};
+    for (int i = 0; i < 16 && dd > 0.0f; ++i) {
+        float t = 0.0f;
+        for (int c = 0; c < 4; ++c) t += (block[i * 4 + c] - a[c]) * d[c];
+        t = t * 64.0f / dd;
+        int best = 0;
+        for (int k = 1; k < 16; ++k)
+            if (fabsf(weights[k] - t) < fabsf(weights[best] - t)) best = k;
+        idx[i] = best;
+    }
+    // the anchor index is stored without its top bit, so it must be < 8
+    if (idx[0] & 8) {
+        for (int c = 0; c < 4; ++c) {
+            int t = q0[c];
+            q0[c] = q1[c];
+            q1[c] = t;
+        }
+        int t = p0;
+        p0 = p1;
+        p1 = t;
+        for (int &i : idx) i = 15 - i;
+    }
+
+    memset(out, 0, 16);
+    int pos = 0;
+    putBits(out, pos, 1 << 6, 7);
+    for (int c = 0; c < 4; ++c) {
+        putBits(out, pos, q0[c], 7);
+        putBits(out, pos, q1[c], 7);
+    }
+    putBits(out, pos, p0, 1);
+    putBits(out, pos, p1, 1);
+    putBits(out, pos, idx[0], 3);
+    for (int i = 1; i < 16; ++i) putBits(out, pos, idx[i], 4);
+}
+
+void encodeLevel(const unsigned char* pixels, int w, int h, TextureCompression c, unsigned char* out)
+{
+    int bw = (w + 3) / 4, bh = (h + 3) / 4;
+    size_t blockBytes = c == COMPRESS_BC1 ? 8 : 16;
+    parallelFor(bh, [&](int by) {
+        unsigned char block[64];
+        for (int bx = 0; bx < bw; ++bx) {
+            fetchBlock(pixels, w, h, bx, by, block);
+            unsigned char* dst = out + ((size_t)by * bw + bx) * blockBytes;
+            if (c == COMPRESS_BC1) encodeBC1Block(block, dst);
+            else encodeBC7Block(block, dst);
+        }
+    });
+}
+
+// cache file for data derived from the picture at `path`, keyed on its path,
+// size and mtime plus whatever `variant` the caller folds in
+std::string imageCachePath(const char* path, const char* kind, const char* ext, int64_t variant)
+{
+    std::string dir = cacheDir();
+    struct stat st;
+    if (dir.empty() || stat(path, &st) != 0) return "";
+    int64_t stamp[3] = {(int64_t)st.st_size, (int64_t)st.st_mtime, variant};
+    uint64_t key = fnv1a(stamp, sizeof(stamp), fnv1a(path, FNV_BASIS));
+    char name[64];
+    snprintf(name, sizeof(name), "/%s-%016llx.%s", kind, (unsigned long long)key, ext);
+    return dir + name;
+}
+
+std::string textureCachePath(const char* path, TextureCompression c)
+{
+    return imageCachePath(path, "texture", c == COMPRESS_BC1 ? "bc1" : "bc7", (int64_t)tileSize() << 8 | c);
+}
+
+bool loadCompressedCache(const std::string& path, TextureCacheHeader& hdr, std::vector<unsigned char>& data)
+{
+    FILE* fp = path.empty() ? NULL : fopen(path.c_str(), "rb");
+    if (!fp) return false;
+    bool ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == TEXTURE_CACHE_MAGIC &&
+              hdr.bytes <= bytesLeft(fp);
+    if (ok) {
+        data.resize(hdr.bytes);
+        ok = fread(data.data(), 1, hdr.bytes, fp) == hdr.bytes;
+    }
+    fclose(fp);
+    return ok;
+}
+
+void saveCompressedCache(const std::string& path, const TextureCacheHeader& hdr, const std::vector<unsigned char>& data)
+{
+    if (!path.empty()) writeCacheFile(path, &hdr, sizeof(hdr), data.data(), data.size());
+}
+
+// bytes the encoded chains of the planned tiles take, which a cached file must
+// match exactly before uploadCompressedChain walks it
+size_t compressedChainsSize(TextureCompression c)
+{
+    size_t bytes = 0;
+    for (auto &t : tiles)
+        for (int level = 0, lw = t.w, lh = t.h; level < t.levels; ++level) {
+            bytes += compressedSize(lw, lh, c);
+            lw = lw > 1 ? lw / 2 : 1;
+            lh = lh > 1 ? lh / 2 : 1;
+        }
+    return bytes;
+}
+
+bool compressionSupported(TextureCompression c)
+{
+    if (c == COMPRESS_BC1) return hasGLExtension("GL_EXT_texture_compression_s3tc");
+    return hasGLExtension("GL_ARB_texture_compression_bptc");
+}
+
+void encodeChain(const unsigned char* pixels, int w, int h, int levels, TextureCompression c,
+                 std::vector<unsigned char>& out)
+{
+    std::vector<unsigned char> cur(pixels, pixels + (size_t)w * h * 4), next;
+    for (int level = 0; level < levels; ++level) {
+        size_t off = out.size();
+        out.resize(off + compressedSize(w, h, c));
+        encodeLevel(cur.data(), w, h, c, out.data() + off);
+        if (level + 1 == levels) break;
+        int nw = w > 1 ? w / 2 : 1;
+        int nh = h > 1 ? h / 2 : 1;
+        next.resize((size_t)nw * nh * 4);
+        downsample2x(cur.data(), w, h, next.data());
+        cur.swap(next);
+        w = nw;
+        h = nh;
+    }
+}
+
+// uploads one tile's encoded chain and returns the bytes it used
+size_t uploadCompressedChain(const ImageTile& t, TextureCompression c, const unsigned char* data)
+{
+    GLenum fmt = c == COMPRESS_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_BPTC_UNORM;
+    glsBindTexture(GL_TEXTURE_2D, t.texture);
+    size_t off = 0;
+    for (int level = 0, lw = t.w, lh = t.h; level < t.levels; ++level) {
+        size_t size = compressedSize(lw, lh, c);
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, fmt, lw, lh, 0, (GLsizei)size, data + off);
+        off += size;
+        lw = lw > 1 ? lw / 2 : 1;
+        lh = lh > 1 ? lh / 2 : 1;
+    }
+    glsCountUpload(off);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, t.levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return off;
+}
+
+// decodes, mips and encodes `path` unless an encoded copy is already cached
+bool loadCompressedTexture(const char* path, int& w, int& h, TextureCompression c)
+{
+    double t0 = now();
+    std::string cachePath = textureCachePath(path, c);
+    TextureCacheHeader hdr;
+    std::vector<unsigned char> data;
+    bool cached = loadCompressedCache(cachePath, hdr, data) && hdr.format == (uint32_t)c &&
+                  hdr.tiles == tileCount(hdr.w, hdr.h);
+    if (cached) {
+        planTiles(hdr.w, hdr.h);
+        cached = hdr.bytes == compressedChainsSize(c);
+        if (!cached) deleteTiles();
+    }
+
+    if (cached) {
+        w = hdr.w;
+        h = hdr.h;
+    } else {
+        unsigned char* pixels = decodeImage(path, w, h);
+        if (!pixels) return false;
+        planTiles(w, h);
+        data.clear();
+        for (auto &t : tiles)
+            encodeChain(tilePixels(pixels, w, t).data(), t.w, t.h, t.levels, c, data);
+        stbi_image_free(pixels);
+        hdr = {TEXTURE_CACHE_MAGIC, (uint32_t)c, w, h, (int32_t)tiles.size(), (uint32_t)data.size()};
+        saveCompressedCache(cachePath, hdr, data);
+    }
+
+    size_t off = 0, rgba = 0;
+    for (auto &t : tiles) {
+        off += uploadCompressedChain(t, c, data.data() + off);
+        for (int level = 0, lw = t.w, lh = t.h; level < t.levels; ++level) {
+            rgba += (size_t)lw * lh * 4;
+            lw = lw > 1 ? lw / 2 : 1;
+            lh = lh > 1 ? lh / 2 : 1;
+        }
+    }
+    printf("texture: %s %dx%d in %zu tile(s), %.1f MB instead of %.1f MB RGBA8 (%.1fx), %s in %.1f ms on %d thread(s)\n",
+           c == COMPRESS_BC1 ? "BC1" : "BC7", w, h, tiles.size(), data.size() / 1048576.0, rgba / 1048576.0,
+           (double)rgba / data.size(), cached ? "loaded from cache" : "encoded",
+           (now() - t0) * 1000.0, (int)pool.threads.size() + 1);
+    return true;
+}
+
+// page layout of the pyramid: levels halve until one page holds the picture;
+// false if a level would collapse to a single row or column first
+bool vtPlan(int w, int h, std::vector<VirtualLevel>& levels)
+{
+    levels.clear();
+    uint32_t first = 0;
+    for (;;) {
+        VirtualLevel lv = {w, h, (w + VT_CONTENT - 1) / VT_CONTENT, (h + VT_CONTENT - 1) / VT_CONTENT, first};
+        levels.push_back(lv);
+        first += lv.pagesX * lv.pagesY;
+        if (w <= VT_CONTENT && h <= VT_CONTENT) return true;
+        if (w < 2 || h < 2) return false;
+        w /= 2;
+        h /= 2;
+    }
+}
+
+struct PageFileHeader {
+    uint32_t magic;
+    int32_t w, h;
+    int32_t levels;
+    uint32_t pages;
+};
+
+// writes pages as soon as enough rows of a level have arrived, so only a
+// band of rows per level is ever held in memory
+struct PyramidBuilder {
+    FILE* fp;
+    std::vector<VirtualLevel> levels;
+    std::vector<uint32_t> fileSlot;
+    uint32_t written;
+    std::vector<std::vector<unsigned char>> rows;
+    std::vector<int> base, band;
+    std::vector<unsigned char> page;
+};
+
+static void emitBands(PyramidBuilder& b, int L)
+{
+    const VirtualLevel &lv = b.levels[L];
+    std::vector<unsigned char> &rows = b.rows[L];
+    size_t rowBytes = (size_t)lv.w * 4;
+    int have = b.base[L] + (int)(rows.size() / rowBytes);
+
+    while (b.band[L] < lv.pagesY) {
+        int y0 = b.band[L] * VT_CONTENT - VT_BORDER;
+        if (have < std::min(y0 + VT_PAGE, lv.h)) return;
+
+        for (int px = 0; px < lv.pagesX; ++px) {
+            int x0 = px * VT_CONTENT - VT_BORDER;
+            for (int r = 0; r < VT_PAGE; ++r) {
+                int sy = std::min(std::max(y0 + r, 0), lv.h - 1) - b.base[L];
+                const unsigned char* src = &rows[sy * rowBytes];
+                unsigned char* dst = &b.page[(size_t)r * VT_PAGE * 4];
+                for (int c = 0; c < VT_PAGE; ++c) {
+                    int sx = std::min(std::max(x0 + c, 0), lv.w - 1);
+                    memcpy(dst + c * 4, src + sx * 4, 4);
+                }
+            }
+            fwrite(b.page.data(), 1, VT_PAGE_BYTES, b.fp);
+            b.fileSlot[lv.first + b.band[L] * lv.pagesX + px] = b.written++;
+        }
+
+        int keep = std::min(++b.band[L] * VT_CONTENT - VT_BORDER, have);
+        if (keep > b.base[L]) {
+            rows.erase(rows.begin(), rows.begin() + (keep - b.base[L]) * rowBytes);
+            b.base[L] = keep;
+        }
+    }
+}
+
+static void pushRow(PyramidBuilder& b, int L, const unsigned char* row)
+{
+    const VirtualLevel &lv = b.levels[L];
+    std::vector<unsigned char> &rows = b.rows[L];
+    size_t rowBytes = (size_t)lv.w * 4;
+    rows.insert(rows.end(), row, row + rowBytes);
+
+    int y = b.base[L] + (int)(rows.size() / rowBytes) - 1;
+    if (L + 1 < (int)b.levels.size() && (y & 1) && y / 2 < b.levels[L + 1].h) {
+        std::vector<unsigned char> half((size_t)b.levels[L + 1].w * 4);
+        downsample2x(&rows[rows.size() - 2 * rowBytes], lv.w, 2, half.data());
+        pushRow(b, L + 1, half.data());
+    }
+    emitBands(b, L);
+}
+
+// binary PPM can be streamed row by row, which is what makes pictures larger
+// than memory possible; returns the file positioned at the first pixel
+FILE* openPPM(const char* path, int& w, int& h)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    int v[3], maxval;
+    bool ok = fgetc(fp) == 'P' && fgetc(fp) == '6';
+    for (int i = 0; ok && i < 3; ++i) {
+        int c = fgetc(fp);
+        while (c == '#' || isspace(c)) {
+            if (c == '#') while (c != '\n' && c != EOF) c = fgetc(fp);
+            c = fgetc(fp);
+        }
+        ok = isdigit(c);
+        for (v[i] = 0; isdigit(c); c = fgetc(fp)) v[i] = v[i] * 10 + (c - '0');
+    }
+    maxval = ok ? v[2] : 0;
+    if (!ok || maxval != 255 || v[0] < 1 || v[1] < 1) {
+        fclose(fp);
+        return NULL;
+    }
+    w = v[0];
+    h = v[1];
+    return fp;
+}
+
+bool vtBuildPageFile(const char* path, const std::string& out)
+{
+    double t0 = now();
+    int w = 0, h = 0;
+    FILE* ppm = openPPM(path, w, h);
+    unsigned char* decoded = NULL;
+    if (!ppm) {
+        int ch;
+        decoded = stbi_load(path, &w, &h, &ch, 4);
+        if (!decoded) {
+            fprintf(stderr, "Failed to load: %s (%s)\n", path, stbi_failure_reason());
+            return false;
+        }
+    }
+
+    PyramidBuilder b = {};
+    bool ok = vtPlan(w, h, b.levels);
+    std::string tmp = out + ".tmp";
+    b.fp = ok ? fopen(tmp.c_str(), "wb") : NULL;
+    if (b.fp) {
+        uint32_t pages = b.levels.back().first + 1;
+        PageFileHeader hdr = {VT_PAGE_FILE_MAGIC, w, h, (int32_t)b.levels.size(), pages};
+        b.fileSlot.assign(pages, VT_NO_PAGE);
+        b.rows.resize(b.levels.size());
+        b.base.assign(b.levels.size(), 0);
+        b.band.assign(b.levels.size(), 0);
+        b.page.resize(VT_PAGE_BYTES);
+        fwrite(&hdr, sizeof(hdr), 1, b.fp);
+        fwrite(b.fileSlot.data(), sizeof(uint32_t), pages, b.fp);
+
+        std::vector<unsigned char> row((size_t)w * 4), rgb((size_t)w * 3);
+        for (int y = 0; y < h && ok; ++y) {
+            if (ppm) {
+                ok = fread(rgb.data(), 1, rgb.size(), ppm) == rgb.size();
+                for (int x = 0; x < w; ++x) {
+                    memcpy(&row[x * 4], &rgb[x * 3], 3);
+                    row[x * 4 + 3] = 255;
+                }
+                pushRow(b, 0, row.data());
+            } else {
+                pushRow(b, 0, decoded + (size_t)y * w * 4);
+            }
+        }
+        ok = ok && b.written == pages;
+        fseek(b.fp, sizeof(hdr), SEEK_SET);
+        fwrite(b.fileSlot.data(), sizeof(uint32_t), pages, b.fp);
+        ok = fclose(b.fp) == 0 && ok;
+        ok = ok && rename(tmp.c_str(), out.c_str()) == 0;
+        if (!ok) remove(tmp.c_str());
+        if (ok)
+            printf("virtual: built %d-level page file for %dx%d in %.1f ms, %.1f MB\n", (int)b.levels.size(),
+                   w, h, (now() - t0) * 1000.0, pages * (VT_PAGE_BYTES / 1048576.0));
+    } else {
+        ok = false;
+    }
+    if (ppm) fclose(ppm);
+    stbi_image_free(decoded);
+    return ok;
+}
+
+void vtReadPage(uint32_t page, unsigned char* dst)
+{
+    off_t at = (off_t)(vt.dataOffset + (size_t)vt.fileSlot[page] * VT_PAGE_BYTES);
+    if (pread(vt.fd, dst, VT_PAGE_BYTES, at) != (ssize_t)VT_PAGE_BYTES)
+        memset(dst, 0, VT_PAGE_BYTES);
+}
+
+void vtUploadPage(uint32_t page, int slot, const unsigned char* pixels)
+{
+    if (vt.slotPage[slot] != VT_NO_PAGE) {
+        vt.cacheSlot[vt.slotPage[slot]] = -1;
+        vt.evictions++;
+    }
+    vt.slotPage[slot] = page;
+    vt.cacheSlot[page] = slot;
+    glsBindTexture(GL_TEXTURE_2D, vt.cache);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, slot % VT_CACHE_PAGES * VT_PAGE, slot / VT_CACHE_PAGES * VT_PAGE,
+                    VT_PAGE, VT_PAGE, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glsCountUpload(VT_PAGE_BYTES);
+    vt.bytesStreamed += VT_PAGE_BYTES;
+    vt.loads++;
+    vt.tableDirty = true;
+}
+
+// opens (building it first if needed) the page file for `path` and sets up
+// the cache and page table; the coarsest page is loaded now and never evicted
+bool vtLoad(const char* path, int& w, int& h)
+{
+    std::string file = imageCachePath(path, "virtual", "pages", VT_PAGE);
+    if (file.empty()) return false;
+
+    PageFileHeader hdr = {};
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        vt.fd = open(file.c_str(), O_RDONLY);
+        if (vt.fd >= 0) {
+            bool ok = read(vt.fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+                      hdr.magic == VT_PAGE_FILE_MAGIC && vtPlan(hdr.w, hdr.h, vt.levels) &&
+                      (int)vt.levels.size() == hdr.levels && vt.levels.back().first + 1 == hdr.pages;
+            if (ok) {
+                vt.fileSlot.resize(hdr.pages);
+                size_t bytes = hdr.pages * sizeof(uint32_t);
+                ok = read(vt.fd, vt.fileSlot.data(), bytes) == (ssize_t)bytes;
+            }
+            if (ok) break;
+            close(vt.fd);
+            vt.fd = -1;
+        }
+        if (attempt == 0 && !vtBuildPageFile(path, file)) return false;
+    }
+    if (vt.fd < 0) return false;
+
+    w = vt.w = hdr.w;
+    h = vt.h = hdr.h;
+    vt.dataOffset = sizeof(hdr) + hdr.pages * sizeof(uint32_t);
+    vt.cacheSlot.assign(hdr.pages, -1);
+    vt.requested.assign(hdr.pages, 0);
+    vt.loading.assign(hdr.pages, false);
+    vt.slotPage.assign(VT_SLOTS, VT_NO_PAGE);
+    vt.slotUsed.assign(VT_SLOTS, 0);
+
+    glGenTextures(1, &vt.cache);
+    glsBindTexture(GL_TEXTURE_2D, vt.cache);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, VT_CACHE_PAGES * VT_PAGE, VT_CACHE_PAGES * VT_PAGE, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // power-of-two table so level L of its mip chain covers level L's pages
+    vt.tableW = vt.tableH = 1;
+    while (vt.tableW < vt.levels[0].pagesX) vt.tableW *= 2;
+    while (vt.tableH < vt.levels[0].pagesY) vt.tableH *= 2;
+    int tableLevels = mipLevels(vt.tableW, vt.tableH);
+    vt.table.resize(tableLevels);
+    glGenTextures(1, &vt.tableTex);
+    glsBindTexture(GL_TEXTURE_2D, vt.tableTex);
+    for (int L = 0; L < tableLevels; ++L) {
+        int tw = std::max(1, vt.tableW >> L), th = std::max(1, vt.tableH >> L);
+        vt.table[L].assign((size_t)tw * th * 4, 0);
+        glTexImage2D(GL_TEXTURE_2D, L, GL_RGBA8, tw, th, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tableLevels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    std::vector<unsigned char> top(VT_PAGE_BYTES);
+    uint32_t topPage = vt.levels.back().first;
+    vtReadPage(topPage, top.data());
+    vtUploadPage(topPage, 0, top.data());
+    vt.slotUsed[0] = ~0ul;
+    vt.loads = 0;
+    vt.bytesStreamed = 0;
+
+    poolStart();
+    vt.active = true;
+    vt.started = now();
+    printf("virtual: %dx%d in %d levels, %u pages on disk, %d-page cache (%.1f MB)\n", w, h,
+           (int)vt.levels.size(), hdr.pages, VT_SLOTS, VT_SLOTS * (VT_PAGE_BYTES / 1048576.0));
+    return true;
+}
+
+// every table entry points at its own page when resident, else inherits the
+// entry of the page covering it one level up
+void vtRebuildTable()
+{
+    int top = (int)vt.levels.size() - 1;
+    for (int L = top; L >= 0; --L) {
+        const VirtualLevel &lv = vt.levels[L];
+        int tw = std::max(1, vt.tableW >> L);
+        int pw = std::max(1, vt.tableW >> (L + 1));
+        for (int py = 0; py < lv.pagesY; ++py) {
+            for (int px = 0; px < lv.pagesX; ++px) {
+                unsigned char* e = &vt.table[L][((size_t)py * tw + px) * 4];
+                int slot = vt.cacheSlot[lv.first + py * lv.pagesX + px];
+                if (slot >= 0) {
+                    e[0] = (unsigned char)(slot % VT_CACHE_PAGES);
+                    e[1] = (unsigned char)(slot / VT_CACHE_PAGES);
+                    e[2] = (unsigned char)L;
+                    e[3] = 255;
+                } else {
+                    memcpy(e, &vt.table[L + 1][((size_t)(py / 2) * pw + px / 2) * 4], 4);
+                }
+            }
+        }
+    }
+    glsBindTexture(GL_TEXTURE_2D, vt.tableTex);
+    for (int L = 0; L <= top; ++L) {
+        int tw = std::max(1, vt.tableW >> L);
+        glTexSubImage2D(GL_TEXTURE_2D, L, 0, 0, tw, vt.levels[L].pagesY, GL_RGBA, GL_UNSIGNED_BYTE,
+                        vt.table[L].data());
+        glsCountUpload((size_t)tw * vt.levels[L].pagesY * 4);
+    }
+    vt.tableDirty = false;
+}
+
+// pages of the level whose texel density matches the piece on screen, biased
+// coarser when the whole request would not fit the cache
+void vtRequestPiece(const PuzzlePiece& p, int bias, std::vector<uint32_t>& out)
+{
+    float px = p.size * view.camera.zoom;
+    float tpp = fmaxf(fabsf(p.u1 - p.u0) * vt.w / (px * view.width), fabsf(p.v1 - p.v0) * vt.h / (px * view.height));
+    int top = (int)vt.levels.size() - 1;
+    int L = (tpp > 1.0f ? (int)floorf(log2f(tpp)) : 0) + bias;
+    if (L > top) L = top;
+
+    const VirtualLevel &lv = vt.levels[L];
+    // padded UVs reach past the picture on its border
+    int x0 = (int)(fmaxf(fminf(p.u0, p.u1), 0.0f) * lv.w) / VT_CONTENT;
+    int x1 = (int)(fminf(fmaxf(p.u0, p.u1), 1.0f) * lv.w) / VT_CONTENT;
+    int y0 = (int)(fmaxf(fminf(p.v0, p.v1), 0.0f) * lv.h) / VT_CONTENT;
+    int y1 = (int)(fminf(fmaxf(p.v0, p.v1), 1.0f) * lv.h) / VT_CONTENT;
+    x1 = std::min(x1, lv.pagesX - 1);
+    y1 = std::min(y1, lv.pagesY - 1);
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            uint32_t id = lv.first + y * lv.pagesX + x;
+            if (vt.requested[id] == vt.stamp) continue;
+            vt.requested[id] = vt.stamp;
+            out.push_back(id);
+        }
+    }
+}
+
+int vtFindSlot()
+{
+    int best = -1;
+    for (int i = 0; i < VT_SLOTS; ++i) {
+        if (vt.slotPage[i] == VT_NO_PAGE) return i;
+        if (vt.slotUsed[i] >= vt.frame) continue;
+        if (best < 0 || vt.slotUsed[i] < vt.slotUsed[best]) best = i;
+    }
+    return best;
+}
+
+// once per frame: touch resident pages, queue missing ones on the worker
+// pool, move finished loads into the cache and refresh the table
+void vtUpdate()
+{
+    if (!vt.active) return;
+    vt.frame++;
+
+    std::vector<uint32_t> want;
+    float x0, y0, x1, y1;
+    visibleRect(x0, y0, x1, y1);
+    int top = (int)vt.levels.size() - 1;
+    for (int bias = 0; bias <= top; ++bias) {
+        want.clear();
+        vt.stamp++;
+        for (auto &p : *view.pieces)
+            if (pieceVisible(p, x0, y0, x1, y1)) vtRequestPiece(p, bias, want);
+        if ((int)want.size() < VT_SLOTS) break;
+    }
+    // coarser levels come later in page order; load them first
+    std::sort(want.begin(), want.end(), std::greater<uint32_t>());
+
+    for (uint32_t id : want) {
+        int slot = vt.cacheSlot[id];
+        if (slot >= 0) {
+            if (vt.slotUsed[slot] != ~0ul) vt.slotUsed[slot] = vt.frame;
+            continue;
+        }
+        if (vt.loading[id] || vt.inflight >= VT_MAX_INFLIGHT) continue;
+        vt.loading[id] = true;
+        vt.inflight++;
+        vt.faults++;
+        poolSubmit([id] {
+            LoadedPage lp;
+            lp.page = id;
+            lp.pixels.resize(VT_PAGE_BYTES);
+            vtReadPage(id, lp.pixels.data());
+            std::lock_guard<std::mutex> lock(vt.mutex);
+            vt.ready.push_back(std::move(lp));
+        });
+    }
+
+    std::vector<LoadedPage> done;
+    {
+        std::lock_guard<std::mutex> lock(vt.mutex);
+        done.swap(vt.ready);
+    }
+    for (size_t i = 0; i < done.size(); ++i) {
+        if ((int)i == VT_UPLOADS_PER_FRAME) {
+            std::lock_guard<std::mutex> lock(vt.mutex);
+            vt.ready.insert(vt.ready.end(), std::make_move_iterator(done.begin() + i),
+                            std::make_move_iterator(done.end()));
+            break;
+        }
+        uint32_t id = done[i].page;
+        vt.loading[id] = false;
+        vt.inflight--;
+        // no slot left that this frame doesn't need; it will be asked for again
+        int slot = vtFindSlot();
+        if (slot < 0) continue;
+        vtUploadPage(id, slot, done[i].pixels.data());
+        vt.slotUsed[slot] = vt.frame;
+    }
+
+    if (vt.tableDirty) {
+        vtRebuildTable();
+        boardValid = false;
+    }
+}
+
+void printVirtualStats()
+{
+    if (!vt.active) return;
+    int resident = 0;
+    for (uint32_t page : vt.slotPage) resident += page != VT_NO_PAGE;
+    double seconds = now() - vt.started;
+    printf("virtual: %lu page faults (%.2f per frame), %lu evictions, %d/%d pages resident (%.1f MB), "
+           "%.1f MB streamed (%.1f MB/s)\n",
+           vt.faults, vt.frame ? (double)vt.faults / vt.frame : 0.0, vt.evictions, resident, VT_SLOTS,
+           resident * (VT_PAGE_BYTES / 1048576.0), vt.bytesStreamed / 1048576.0,
+           seconds > 0.0 ? vt.bytesStreamed / 1048576.0 / seconds : 0.0);
+}
+
+// the table entry of the wanted page names the cache slot and level of the
+// page actually used; its position inside that page follows from the level
+const char* vtSampleSource =
+    "uniform vec4 vtImage;\n"
+    "uniform vec4 vtCache;\n"
+    "vec4 sampleVirtual(vec2 uv, vec2 dx, vec2 dy){\n"
+    "    uv = clamp(uv, 0.0, 1.0);\n"
+    "    float rho = max(length(dx * vtImage.xy), length(dy * vtImage.xy));\n"
+    "    int want = int(clamp(floor(log2(max(rho, 1.0))), 0.0, vtImage.z));\n"
+    "    vec2 size = max(floor(vtImage.xy / exp2(float(want))), 1.0);\n"
+    "    ivec2 page = min(ivec2(uv * size / vtImage.w), ivec2(ceil(size / vtImage.w)) - 1);\n"
+    "    vec4 e = floor(texelFetch(tiles[1], page, want) * 255.0 + 0.5);\n"
+    "    int level = int(e.z);\n"
+    "    vec2 rsize = max(floor(vtImage.xy / exp2(e.z)), 1.0);\n"
+    "    vec2 inPage = uv * rsize / vtImage.w - vec2(page >> (level - want));\n"
+    "    float b = vtCache.z / vtImage.w;\n"
+    "    inPage = clamp(inPage, -b, 1.0 + b);\n"
+    "    vec2 st = (e.xy * vtCache.y + vtCache.z + inPage * vtImage.w) / vtCache.x;\n"
+    "    return textureLod(tiles[0], st, 0.0);\n"
+    "}\n";
+
+void vtShutdown()
+{
+    if (!vt.active) return;
+    glsDeleteTexture(vt.cache);
+    glsDeleteTexture(vt.tableTex);
+    close(vt.fd);
+    vt.active = false;
+}
+
+// fills `tiles` with the picture at `path`; uncompressed tiles stream in over
+// the next frames through textureUploadStep()
+bool loadTexture(const char* path, int& w, int& h)
+{
+    // too big for the tile units: page it in rather than halving it
+    int ch;
+    if (!virtualTexture && stbi_info(path, &w, &h, &ch) && tileCount(w, h) > TILE_UNITS) virtualTexture = true;
+    if (virtualTexture) {
+        if (vtLoad(path, w, h)) return true;
+        fprintf(stderr, "virtual: could not page %s, decoding it instead\n", path);
+    }
+
+    if (compression != COMPRESS_NONE) {
+        if (compressionSupported(compression)) return loadCompressedTexture(path, w, h, compression);
+        fprintf(stderr, "texture: %s not supported by this driver, using RGBA8\n",
+                compression == COMPRESS_BC1 ? "BC1" : "BC7");
+    }
+
+    unsigned char* data = decodeImage(path, w, h);
+    if (!data) return false;
+
+    planTiles(w, h);
+    for (auto &t : tiles) {
+        glsBindTexture(GL_TEXTURE_2D, t.texture);
+        if (texStorage2D) {
+            texStorage2D(GL_TEXTURE_2D, t.levels, GL_RGBA8, t.w, t.h);
+        } else {
+            for (int level = 0, lw = t.w, lh = t.h; level < t.levels; ++level) {
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, lw, lh, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+                lw = lw > 1 ? lw / 2 : 1;
+                lh = lh > 1 ? lh / 2 : 1;
+            }
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // only level 0 is sampled until the whole chain exists
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+
+    upload = {};
+    upload.pixels = data;
+    upload.w = w;
+    upload.h = h;
+    upload.started = now();
+
+    if (syncUpload) {
+        for (auto &t : tiles) {
+            glsBindTexture(GL_TEXTURE_2D, t.texture);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, t.w, t.h, GL_RGBA, GL_UNSIGNED_BYTE,
+                            data + ((size_t)t.y * w + t.x) * 4);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            glsCountUpload((size_t)t.w * t.h * 4);
+            finishTile(t);
+        }
+        upload.frames = 1;
+        finishTextureUpload();
+    } else {
+        glGenBuffers(1, &upload.pbo);
+    }
+    return true;
+}
+
+// --boards: boards are laid out row by row, each picture decoded once into
+// a layer at the first one's size (at most PICTURE_LAYER_MAX); boards with
+// the same picture share its layer
+bool loadBoards(const std::vector<const char*>& paths, int count)
+{
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    double t0 = now();
+    int cols = (int)ceilf(sqrtf((float)count)), rows = (count + cols - 1) / cols;
+    std::vector<std::vector<unsigned char>> layers;
+    boards.clear();
+    for (int b = 0; b < count; ++b) {
+        Board board = {};
+        board.image = paths[b % paths.size()];
+        board.x = (b % cols - (cols - 1) * 0.5f) * BOARD_SPACING;
+        board.y = ((rows - 1) * 0.5f - b / cols) * BOARD_SPACING;
+        board.layer = -1;
+        for (const Board &o : boards)
+            if (o.image == board.image) board.layer = o.layer;
+        if (board.layer < 0) {
+            if ((int)layers.size() == maxLayers) {
+                fprintf(stderr, "boards: only %d pictures fit in an array texture\n", maxLayers);
+                return false;
+            }
+            int w, h;
+            unsigned char* data = decodeImage(board.image.c_str(), w, h);
+            if (!data) return false;
+            if (layers.empty()) {
+                float scale = fminf(1.0f, (float)std::min(PICTURE_LAYER_MAX, maxTextureSize) / std::max(w, h));
+                pictureW = std::max(1, (int)(w * scale));
+                pictureH = std::max(1, (int)(h * scale));
+            }
+            layers.push_back(resizeImage(data, w, h, pictureW, pictureH));
+            stbi_image_free(data);
+            board.layer = (int)layers.size() - 1;
+        }
+        boards.push_back(board);
+    }
+    pictureLayers = (int)layers.size();
+
+    glGenTextures(1, &pictureArray);
+    glsActiveTexture(GL_TEXTURE0 + PICTURE_ARRAY_UNIT);
+    glsBindTexture(GL_TEXTURE_2D_ARRAY, pictureArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, pictureW, pictureH, pictureLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    for (int l = 0; l < pictureLayers; ++l) {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, l, pictureW, pictureH, 1, GL_RGBA, GL_UNSIGNED_BYTE, layers[l].data());
+        glsCountUpload(layers[l].size());
+    }
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // start zoomed out far enough to see every board
+    float fit = 1.0f / std::max(cols, rows);
+    zoomMin = fminf(ZOOM_MIN, fit);
+    camera = {0.0f, 0.0f, fit};
+    printf("boards: %d boards, %d picture(s) in a %dx%dx%d array texture, loaded in %.1f ms\n",
+           count, pictureLayers, pictureW, pictureH, pictureLayers, (now() - t0) * 1000.0);
+    return true;
+}
+
+// bytes of one layer with its mip chain
+size_t pictureLayerBytes()
+{
+    size_t bytes = 0;
+    for (int w = pictureW, h = pictureH;; w = std::max(1, w / 2), h = std::max(1, h / 2)) {
+        bytes += (size_t)w * h * 4;
+        if (w == 1 && h == 1) break;
+    }
+    return bytes;
+}
+
+// memory is the board's picture layer (halved among boards sharing it) and
+// its pieces; every board is in the same draws, so the per-board figure is
+// the instances it put into them
+void printBoardStats(unsigned long frames)
+{
+    if (boards.empty() || frames == 0) return;
+    printf("boards: %zu boards, %.1f draws per frame for all of them, %.1f MB of pictures\n",
+           boards.size(), (double)glStatsTotal.draws / frames, pictureLayerBytes() * pictureLayers / (1024.0 * 1024.0));
+    for (size_t b = 0; b < boards.size(); ++b) {
+        int sharing = 0, count = 0, snapped = 0;
+        for (const Board &o : boards) sharing += o.layer == boards[b].layer;
+        for (const PuzzlePiece &p : pieces) {
+            if (p.board != (int)b) continue;
+            count++;
+            snapped += p.snapped;
+        }
+        printf("board %zu: %s, %d pieces (%d snapped), %.2f MB picture, %.1f KB pieces, %.1f instances per frame\n",
+               b, boards[b].image.c_str(), count, snapped, pictureLayerBytes() / (1024.0 * 1024.0) / sharing,
+               count * sizeof(PuzzlePiece) / 1024.0, (double)boards[b].instances / frames);
+    }
+}
+
+// a piece inside one tile keeps that tile's local UVs; one straddling a seam
+// gets tile -1 and is cut per tile when its instances are written
+void assignTile(PuzzlePiece& p)
+{
+    if (pictureArray) {
+        p.tile = PICTURE_LAYER_BASE + boards[p.board].layer;
+        p.tu0 = p.u0;
+        p.tv0 = p.v0;
+        p.tu1 = p.u1;
+        p.tv1 = p.v1;
+        return;
+    }
+    if (vt.active) {
+        p.tile = VT_CACHE_UNIT;
+        p.tu0 = p.u0;
+        p.tv0 = p.v0;
+        p.tu1 = p.u1;
+        p.tv1 = p.v1;
+        return;
+    }
+    // padding past the picture's edge is always masked away, so it doesn't
+    // make a border piece straddle
+    float umin = fmaxf(fminf(p.u0, p.u1), 0.0f), umax = fminf(fmaxf(p.u0, p.u1), 1.0f);
+    float vmin = fmaxf(fminf(p.v0, p.v1), 0.0f), vmax = fminf(fmaxf(p.v0, p.v1), 1.0f);
+    p.tile = -1;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        const ImageTile &t = tiles[i];
+        if (umin >= t.u0 && umax <= t.u1 && vmin >= t.v0 && vmax <= t.v1) {
+            p.tile = (int)i;
+            p.tu0 = (p.u0 - t.u0) / (t.u1 - t.u0);
+            p.tu1 = (p.u1 - t.u0) / (t.u1 - t.u0);
+            p.tv0 = (p.v0 - t.v0) / (t.v1 - t.v0);
+            p.tv1 = (p.v1 - t.v0) / (t.v1 - t.v0);
+            return;
+        }
+    }
+}
+
+// the curve of inner edge `key` in its own frame, x along the edge and y
+// across it in cells: the points after the start corner, the last one being
+// the end corner. Both pieces on the edge get the same points from the seed
+void edgeCurve(uint64_t seed, int key, float pts[MESH_EDGE_POINTS][2])
+{
+    uint64_t h = fnv1a(&key, sizeof(key), seed);
+    float r[6];
+    for (float &v : r) {
+        h = h * 6364136223846793005ull + 1442695040888963407ull;
+        v = (float)(h >> 40) / (float)(1 << 24) * 2.0f - 1.0f;
+    }
+    float t = MESH_TAB, side = r[5] < 0.0f ? -1.0f : 1.0f;
+    float a = r[0] * MESH_JITTER, b = r[1] * MESH_JITTER, c = r[2] * MESH_JITTER;
+    float d = r[3] * MESH_JITTER, e = r[4] * MESH_JITTER;
+    const float cp[10][2] = {
+        {0.0f, 0.0f}, {0.2f, a}, {0.5f + b + d, -t + c}, {0.5f - t + b, t + c},
+        {0.5f - 2.0f * t + b - d, 3.0f * t + c}, {0.5f + 2.0f * t + b - d, 3.0f * t + c},
+        {0.5f + t + b, t + c}, {0.5f + b + d, -t + c}, {0.8f, e}, {1.0f, 0.0f}
+    };
+    for (int seg = 0; seg < 3; ++seg) {
+        const float (*q)[2] = cp + 3 * seg;
+        for (int k = 1; k <= MESH_SAMPLES; ++k) {
+            float s = (float)k / MESH_SAMPLES, u = 1.0f - s;
+            float w0 = u * u * u, w1 = 3.0f * u * u * s, w2 = 3.0f * u * s * s, w3 = s * s * s;
+            float* o = pts[seg * MESH_SAMPLES + k - 1];
+            o[0] = w0 * q[0][0] + w1 * q[1][0] + w2 * q[2][0] + w3 * q[3][0];
+            o[1] = side * (w0 * q[0][1] + w1 * q[1][1] + w2 * q[2][1] + w3 * q[3][1]);
+        }
+    }
+}
+
+// ear clipping for the small counter-clockwise polygons an edge adds to its
+// piece; `ring` holds vertex ids and is consumed. Always n - 2 triangles: if
+// rounding leaves no clean ear, the current corner is cut anyway
+uint16_t* earClip(const float (*pts)[2], uint16_t* ring, int n, uint16_t* out)
+{
+    auto cross = [&](int a, int b, int c) {
+        return (pts[b][0] - pts[a][0]) * (pts[c][1] - pts[a][1]) -
+               (pts[b][1] - pts[a][1]) * (pts[c][0] - pts[a][0]);
+    };
+    int i = 0, misses = 0;
+    while (n > 3) {
+        int a = ring[(i + n - 1) % n], b = ring[i], c = ring[(i + 1) % n];
+        bool ear = cross(a, b, c) > 0.0f;
+        for (int k = 0; ear && k < n; ++k) {
+            int q = ring[k];
+            if (q == a || q == b || q == c) continue;
+            ear = !(cross(a, b, q) >= 0.0f && cross(b, c, q) >= 0.0f && cross(c, a, q) >= 0.0f);
+        }
+        if (!ear && ++misses <= n) {
+            i = (i + 1) % n;
+            continue;
+        }
+        *out++ = (uint16_t)a;
+        *out++ = (uint16_t)b;
+        *out++ = (uint16_t)c;
+        for (int k = i; k < n - 1; ++k) ring[k] = ring[k + 1];
+        n--;
+        i = (i + n - 1) % n;
+        misses = 0;
+    }
+    *out++ = ring[0];
+    *out++ = ring[1];
+    *out++ = ring[2];
+    return out;
+}
+
+// one piece's outline vertices and all its levels, written into its block.
+// Edges go counter-clockwise from the bottom; top and left ones are walked
+// against their canonical direction
+void buildPieceMesh(uint64_t seed, int grid, int row, int col)
+{
+    int id = row * grid + col;
+    MeshVertex* verts = &meshes.vertices[(size_t)id * MESH_MAX_VERTS];
+    uint16_t* indices = &meshes.indices[(size_t)id * MESH_MAX_INDICES];
+    uint16_t* counts = &meshes.counts[(size_t)id * MESH_LODS];
+
+    // cell coordinates, the cell being [0, 1] on both axes
+    float pts[MESH_MAX_VERTS][2];
+    int n = 1, corner[4];
+    bool curved[4];
+    pts[0][0] = pts[0][1] = 0.5f;
+    const float corners[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+    for (int e = 0; e < 4; ++e) {
+        corner[e] = n;
+        pts[n][0] = corners[e][0];
+        pts[n][1] = corners[e][1];
+        n++;
+        // horizontal edges are keyed by the row above them, vertical ones by
+        // the column to their right
+        bool horizontal = e % 2 == 0;
+        int er = row + (e == 2), ec = col + (e == 1);
+        curved[e] = horizontal ? er > 0 && er < grid : ec > 0 && ec < grid;
+        if (!curved[e]) continue;
+        float curve[MESH_EDGE_POINTS][2];
+        int key = (er * (grid + 1) + ec) * 2 + !horizontal;
+        edgeCurve(seed, key, curve);
+        for (int k = 1; k < MESH_EDGE_POINTS; ++k) {
+            const float* c = curve[e < 2 ? k - 1 : MESH_EDGE_POINTS - 1 - k];
+            pts[n][0] = horizontal ? c[0] : ec - col + c[1];
+            pts[n][1] = horizontal ? er - row + c[1] : c[0];
+            n++;
+        }
+    }
+
+    uint16_t* out = indices;
+    for (int lod = 0; lod < MESH_LODS; ++lod) {
+        uint16_t* start = indices + 36 * ((1 << lod) - 1);
+        out = start;
+        int stride = MESH_SAMPLES >> lod;
+        for (int e = 0; e < 4; ++e) {
+            uint16_t ring[3 + MESH_EDGE_POINTS];
+            int m = 0;
+            ring[m++] = 0;
+            ring[m++] = (uint16_t)corner[e];
+            if (curved[e])
+                for (int k = stride; k < MESH_EDGE_POINTS; k += stride) ring[m++] = (uint16_t)(corner[e] + k);
+            ring[m++] = (uint16_t)corner[(e + 1) % 4];
+            out = earClip(pts, ring, m, out);
+        }
+        counts[lod] = (uint16_t)(out - start);
+    }
+
+    float span = 1.0f + 2.0f * PIECE_PAD;
+    for (int i = 0; i < n; ++i)
+        verts[i] = {(pts[i][0] - 0.5f) / span, (pts[i][1] - 0.5f) / span, (float)id};
+}
+
+void buildMeshes(uint64_t seed, int grid)
+{
+    double t0 = now();
+    size_t count = (size_t)grid * grid;
+    meshes.vertices.assign(count * MESH_MAX_VERTS, MeshVertex{0.0f, 0.0f, 0.0f});
+    meshes.indices.assign(count * MESH_MAX_INDICES, 0);
+    meshes.counts.assign(count * MESH_LODS, 0);
+    meshes.version = ++meshVersion;
+    parallelFor((int)count, [&](int id) { buildPieceMesh(seed, grid, id / grid, id % grid); });
+    size_t bytes = meshes.vertices.size() * sizeof(MeshVertex) + meshes.indices.size() * sizeof(uint16_t);
+    printf("meshes: %zu pieces, %d levels, %.1f MB, built in %.1f ms\n",
+           count, MESH_LODS, bytes / (1024.0 * 1024.0), (now() - t0) * 1000.0);
+}
+
+std::vector<PuzzlePiece> generatePieces(int grid, int board = 0)
+{
+    srand((unsigned)time(NULL) + board);
+    float ox = boards.empty() ? 0.0f : boards[board].x;
+    float oy = boards.empty() ? 0.0f : boards[board].y;
+    if (meshPieces) buildMeshes(((uint64_t)rand() << 32) ^ (uint64_t)rand(), grid);
+    std::vector<PuzzlePiece> out;
+    out.reserve(grid * grid);
+
+    float half = 0.5f / grid;
+    float cell = 2.0f * half;
+
+    // a tab or blank for every inner edge, seen from the piece below / left of it
+    std::vector<int> up(grid * grid), right(grid * grid);
+    for (int i = 0; i < grid * grid; ++i) {
+        up[i] = rand() % 2 ? EDGE_TAB : EDGE_BLANK;
+        right[i] = rand() % 2 ? EDGE_TAB : EDGE_BLANK;
+    }
+    auto flip = [](int e) { return e == EDGE_TAB ? EDGE_BLANK : EDGE_TAB; };
+
+    for (int row = 0; row < grid; ++row) {
+        for (int col = 0; col < grid; ++col) {
+            PuzzlePiece p;
+
+			//TODO picture is upside down need to flip it again
+			stbi_set_flip_vertically_on_load(1);
+            float u_left   = col / float(grid);
+            float u_right  = (col + 1) / float(grid);
+            float v_top    = row / float(grid);
+            float v_bottom = (row + 1) / float(grid);
+
+            p.u0 = u_left;
+            p.u1 = u_right;
+			//NOTE changing v_top to v_bottom fixs the above issue, however Y positions of top and bot change places
+            p.v0 = 1.0f - v_top;
+            p.v1 = 1.0f - v_bottom;
+
+            p.size = half;
+
+            int top = row == grid - 1 ? EDGE_FLAT : up[row * grid + col];
+            int bottom = row == 0 ? EDGE_FLAT : flip(up[(row - 1) * grid + col]);
+            int rgt = col == grid - 1 ? EDGE_FLAT : right[row * grid + col];
+            int lft = col == 0 ? EDGE_FLAT : flip(right[row * grid + col - 1]);
+            p.shape = top + 3 * rgt + 9 * bottom + 27 * lft;
+            p.id = row * grid + col;
+
+            p.extent = half * (1.0f + 2.0f * PIECE_PAD);
+            float du = (p.u1 - p.u0) * PIECE_PAD, dv = (p.v1 - p.v0) * PIECE_PAD;
+            p.u0 -= du;
+            p.u1 += du;
+            p.v0 -= dv;
+            p.v1 += dv;
+
+            p.tx = ((col + 0.5f) - grid / 2.0f) * cell + ox;
+            p.ty = ((row + 0.5f) - grid / 2.0f) * cell + oy;
+
+            p.x = ((rand() % 2000) / 1000.0f - 1.0f) * SCATTER_HALF + ox;
+            p.y = ((rand() % 2000) / 1000.0f - 1.0f) * SCATTER_HALF + oy;
+
+            p.snapped = false;
+            p.board = board;
+            p.depth = ++depthCounter;
+            p.tween = -1;
+            assignTile(p);
+            out.push_back(p);
+        }
+    }
+    stackVersion++;
+    boardGeneration++;
+    return out;
+}
+
+// hands out keys from 1 in the current stacking order
+void renumberDepths()
+{
+    std::vector<PuzzlePiece*> order;
+    for (auto &p : pieces) order.push_back(&p);
+    std::sort(order.begin(), order.end(), [](PuzzlePiece* a, PuzzlePiece* b) { return a->depth < b->depth; });
+    depthCounter = 0;
+    for (PuzzlePiece* p : order) p->depth = ++depthCounter;
+    stackVersion++;
+}
+
+// the piece only takes the next key; nothing in `pieces` moves
+void raisePiece(int idx)
+{
+    if (idx < 0 || idx >= (int)pieces.size()) return;
+    if (depthCounter + 1 >= DEPTH_KEYS) renumberDepths();
+    pieces[idx].depth = ++depthCounter;
+    stackVersion++;
+}
+
+// adds a rect to the minimap's dirty list, swallowing the ones it overlaps;
+// past MINIMAP_MAX_RECTS the list collapses into their bounding rect
+void minimapMarkRect(MapRect r)
+{
+    for (size_t i = 0; i < mapDirty.size();) {
+        const MapRect &o = mapDirty[i];
+        if (o.x0 > r.x1 || o.x1 < r.x0 || o.y0 > r.y1 || o.y1 < r.y0) {
+            ++i;
+            continue;
+        }
+        r = {fminf(r.x0, o.x0), fminf(r.y0, o.y0), fmaxf(r.x1, o.x1), fmaxf(r.y1, o.y1)};
+        mapDirty[i] = mapDirty.back();
+        mapDirty.pop_back();
+        // the grown rect may reach ones already passed
+        i = 0;
+    }
+    if (mapDirty.size() == MINIMAP_MAX_RECTS) {
+        for (const MapRect &o : mapDirty)
+            r = {fminf(r.x0, o.x0), fminf(r.y0, o.y0), fmaxf(r.x1, o.x1), fmaxf(r.y1, o.y1)};
+        mapDirty.clear();
+    }
+    mapDirty.push_back(r);
+}
+
+// where the piece is now; called before and after it moves
+void minimapMark(const PuzzlePiece& p)
+{
+    if (minimapEnabled) minimapMarkRect({p.x - p.extent, p.y - p.extent, p.x + p.extent, p.y + p.extent});
+}
+
+// piece tweens, kept as structure of arrays so a tick eases four of them per
+// SIMD step. Slots [0, count) are live and a finished one is overwritten by
+// the last, so once the arrays have grown nothing is allocated
+enum TweenKind { TWEEN_MOVE, TWEEN_SNAP };
+
+struct Tweens {
+    std::vector<float> x0, y0, dx, dy;
+    std::vector<float> t, rate;
+    std::vector<float> x, y;
+    std::vector<int> piece;
+    std::vector<uint8_t> kind;
+    size_t count;
+    double clock, behind;
+    unsigned long started, ticks;
+    size_t peak;
+    double tickTime;
+};
+Tweens tweens = {};
+
+void snapPiece(PuzzlePiece& p)
+{
+    minimapMark(p);
+    p.x = p.tx;
+    p.y = p.ty;
+    p.snapped = true;
+    minimapMark(p);
+    snapCount++;
+    if (!renderThread) boardQueue.push_back(p);
+}
+
+// moves the piece from where it is to (x, y); a snap also snaps it on arrival
+void tweenStart(int idx, float x, float y, float seconds, TweenKind kind)
+{
+    PuzzlePiece &p = pieces[idx];
+    size_t i = (size_t)p.tween;
+    if (p.tween < 0) {
+        if (tweens.count == 0) {
+            tweens.clock = now();
+            tweens.behind = 0.0;
+        }
+        i = tweens.count++;
+        if (i == tweens.piece.size()) {
+            for (auto *a : {&tweens.x0, &tweens.y0, &tweens.dx, &tweens.dy, &tweens.t, &tweens.rate, &tweens.x, &tweens.y})
+                a->push_back(0.0f);
+            tweens.piece.push_back(0);
+            tweens.kind.push_back(0);
+        }
+        p.tween = (int)i;
+        tweens.peak = std::max(tweens.peak, tweens.count);
+    }
+    tweens.x0[i] = p.x;
+    tweens.y0[i] = p.y;
+    tweens.dx[i] = x - p.x;
+    tweens.dy[i] = y - p.y;
+    tweens.t[i] = 0.0f;
+    tweens.rate[i] = (float)(SIM_TICK / seconds);
+    tweens.piece[i] = idx;
+    tweens.kind[i] = (uint8_t)kind;
+    tweens.started++;
+}
+
+void tweenRetire(size_t i)
+{
+    pieces[tweens.piece[i]].tween = -1;
+    size_t last = --tweens.count;
+    if (i == last) return;
+    for (auto *a : {&tweens.x0, &tweens.y0, &tweens.dx, &tweens.dy, &tweens.t, &tweens.rate, &tweens.x, &tweens.y})
+        (*a)[i] = (*a)[last];
+    tweens.piece[i] = tweens.piece[last];
+    tweens.kind[i] = tweens.kind[last];
+    pieces[tweens.piece[i]].tween = (int)i;
+}
+
+// the piece stays where the tween has got it to
+void tweenCancel(int idx)
+{
+    if (pieces[idx].tween >= 0) tweenRetire((size_t)pieces[idx].tween);
+}
+
+// one fixed step: t advances by `rate` and positions ease out cubically
+void tweenTick()
+{
+    size_t n = tweens.count, i = 0;
+    float *t = tweens.t.data(), *rate = tweens.rate.data();
+    const float *x0 = tweens.x0.data(), *y0 = tweens.y0.data(), *dx = tweens.dx.data(), *dy = tweens.dy.data();
+    float *x = tweens.x.data(), *y = tweens.y.data();
+#if defined(__SSE2__)
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 s = _mm_min_ps(_mm_add_ps(_mm_loadu_ps(t + i), _mm_loadu_ps(rate + i)), one);
+        _mm_storeu_ps(t + i, s);
+        __m128 u = _mm_sub_ps(one, s);
+        __m128 e = _mm_sub_ps(one, _mm_mul_ps(_mm_mul_ps(u, u), u));
+        _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x0 + i), _mm_mul_ps(_mm_loadu_ps(dx + i), e)));
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y0 + i), _mm_mul_ps(_mm_loadu_ps(dy + i), e)));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t s = vminq_f32(vaddq_f32(vld1q_f32(t + i), vld1q_f32(rate + i)), one);
+        vst1q_f32(t + i, s);
+        float32x4_t u = vsubq_f32(one, s);
+        float32x4_t e = vsubq_f32(one, vmulq_f32(vmulq_f32(u, u), u));
+        vst1q_f32(x + i, vaddq_f32(vld1q_f32(x0 + i), vmulq_f32(vld1q_f32(dx + i), e)));
+        vst1q_f32(y + i, vaddq_f32(vld1q_f32(y0 + i), vmulq_f32(vld1q_f32(dy + i), e)));
+    }
+#endif
+    for (; i < n; ++i) {
+        float s = fminf(t[i] + rate[i], 1.0f);
+        t[i] = s;
+        float u = 1.0f - s;
+        float e = 1.0f - u * u * u;
+        x[i] = x0[i] + dx[i] * e;
+        y[i] = y0[i] + dy[i] * e;
+    }
+
+    // pieces live in AoS, so positions go back one by one; a retired slot
+    // takes the last tween, which is looked at again
+    for (size_t j = 0; j < tweens.count;) {
+        PuzzlePiece &p = pieces[tweens.piece[j]];
+        minimapMark(p);
+        p.x = tweens.x[j];
+        p.y = tweens.y[j];
+        minimapMark(p);
+        if (tweens.t[j] < 1.0f) {
+            ++j;
+            continue;
+        }
+        bool snap = tweens.kind[j] == TWEEN_SNAP;
+        tweenRetire(j);
+        if (snap) snapPiece(p);
+    }
+}
+
+// runs the whole ticks due by time t; returns whether anything moved
+bool tweenAdvance(double t)
+{
+    if (tweens.count == 0) return false;
+    tweens.behind = fmin(tweens.behind + t - tweens.clock, TWEEN_MAX_CATCHUP);
+    tweens.clock = t;
+    if (tweens.behind < SIM_TICK) return false;
+    double start = now();
+    while (tweens.behind >= SIM_TICK && tweens.count) {
+        tweenTick();
+        tweens.behind -= SIM_TICK;
+        tweens.ticks++;
+    }
+    tweens.tickTime += now() - start;
+    return true;
+}
+
+// lands every tween at once, e.g. before the board is replaced
+void tweenFinishAll()
+{
+    while (tweens.count) {
+        std::fill(tweens.t.begin(), tweens.t.begin() + tweens.count, 1.0f);
+        tweenTick();
+    }
+}
+
+// S key: every loose piece flies to a new spot on its board
+void scatterPieces()
+{
+    for (int i = 0; i < (int)pieces.size(); ++i) {
+        const PuzzlePiece &p = pieces[i];
+        if (p.snapped || i == dragged) continue;
+        float ox = boards.empty() ? 0.0f : boards[p.board].x;
+        float oy = boards.empty() ? 0.0f : boards[p.board].y;
+        float x = ((rand() % 2000) / 1000.0f - 1.0f) * SCATTER_HALF + ox;
+        float y = ((rand() % 2000) / 1000.0f - 1.0f) * SCATTER_HALF + oy;
+        tweenStart(i, x, y, SCATTER_TIME + SCATTER_JITTER * (rand() % 1000) / 1000.0f, TWEEN_MOVE);
+    }
+}
+
+void printTweenStats()
+{
+    if (tweens.started == 0) return;
+    printf("tweens: %lu started, up to %zu at once, %lu ticks at %.3f ms each\n", tweens.started, tweens.peak,
+           tweens.ticks, tweens.ticks ? tweens.tickTime * 1000.0 / tweens.ticks : 0.0);
+}
+
+void streamInit(bool orphan)
+{
+    stream.slotSize = STREAM_SLOT_BYTES;
+    stream.orphan = orphan;
+    glGenBuffers(1, &stream.buffer);
+    glsBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glsBufferData(GL_ARRAY_BUFFER, stream.slotSize * STREAM_SLOTS, NULL, GL_STREAM_DRAW);
+}
+
+void streamDropFences()
+{
+    for (GLsync &f : stream.fences) {
+        if (f) glDeleteSync(f);
+        f = 0;
+    }
+}
+
+void streamBeginFrame()
+{
+    glsBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    stream.used = 0;
+    stream.frames++;
+
+    if (stream.orphan) {
+        glsBufferData(GL_ARRAY_BUFFER, stream.slotSize * STREAM_SLOTS, NULL, GL_STREAM_DRAW);
+        stream.slot = 0;
+        return;
+    }
+
+    stream.slot = (stream.slot + 1) % STREAM_SLOTS;
+    GLsync f = stream.fences[stream.slot];
+    if (!f) return;
+    if (glClientWaitSync(f, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        stream.waits++;
+        while (glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+    }
+    glDeleteSync(f);
+    stream.fences[stream.slot] = 0;
+}
+
+// returns write-only memory for `bytes` of this frame's slot and the buffer offset
+// it lives at; unmap with streamUnmap() before issuing the draw that reads it
+void* streamMap(size_t bytes, size_t& offset)
+{
+    glsBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+
+    size_t start = (stream.used + STREAM_ALIGN - 1) & ~(STREAM_ALIGN - 1);
+    if (start + bytes > stream.slotSize) {
+        // earlier draws this frame keep the orphaned storage alive
+        streamDropFences();
+        while (stream.slotSize < start + bytes) stream.slotSize *= 2;
+        glsBufferData(GL_ARRAY_BUFFER, stream.slotSize * STREAM_SLOTS, NULL, GL_STREAM_DRAW);
+        start = 0;
+    }
+    offset = stream.slot * stream.slotSize + start;
+    stream.used = start + bytes;
+
+    double t0 = now();
+    void* ptr = glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    stream.mapSeconds += now() - t0;
+    stream.maps++;
+    glsCountUpload(bytes);
+    if (!ptr) {
+        if (!stream.failedMaps++)
+            fprintf(stderr, "stream: glMapBufferRange failed (0x%x), copying with glBufferSubData\n", glGetError());
+        stream.fallback.resize(bytes);
+        stream.fallbackOffset = offset;
+        ptr = stream.fallback.data();
+    }
+    return ptr;
+}
+
+void streamUnmap()
+{
+    glsBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    if (stream.fallback.empty()) {
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        return;
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, stream.fallbackOffset, stream.fallback.size(), stream.fallback.data());
+    stream.fallback.clear();
+}
+
+void streamEndFrame()
+{
+    if (stream.orphan) return;
+    stream.fences[stream.slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // some drivers serialize unsynchronized maps anyway; orphaning is cheaper there
+    if (stream.frames == STREAM_PROBE_FRAMES && stream.mapSeconds / stream.maps > STREAM_SLOW_MAP) {
+        printf("stream: unsynchronized maps average %.3f ms, switching to orphaning\n",
+               stream.mapSeconds * 1000.0 / stream.maps);
+        streamDropFences();
+        stream.orphan = true;
+    }
+}
+
+void printStreamStats()
+{
+    if (softwareBackend) return;
+    printf("stream: %s, %lu frames, %lu waited on GPU (%.1f%%), %.3f ms per map\n",
+           stream.orphan ? "orphan" : "ring", stream.frames, stream.waits,
+           stream.frames ? 100.0 * stream.waits / stream.frames : 0.0,
+           stream.maps ? stream.mapSeconds * 1000.0 / stream.maps : 0.0);
+}
+
+void setXform(float sx, float sy, float ox, float oy)
+{
+    glsUniform4f(texShaderXform, sx, sy, ox, oy);
+}
+
+void setCameraXform()
+{
+    const Camera &c = view.camera;
+    setXform(c.zoom, c.zoom, -c.x * c.zoom, -c.y * c.zoom);
+}
+
+void drawInstances(size_t offset, size_t count)
+{
+    glVertexAttribPointer(2,4,GL_FLOAT,GL_FALSE,sizeof(PieceInstance),(void*)offset);
+    glVertexAttribPointer(3,4,GL_FLOAT,GL_FALSE,sizeof(PieceInstance),(void*)(offset + 4*sizeof(float)));
+    glVertexAttribPointer(4,1,GL_FLOAT,GL_FALSE,sizeof(PieceInstance),(void*)(offset + 8*sizeof(float)));
+    glVertexAttribPointer(7,1,GL_FLOAT,GL_FALSE,sizeof(PieceInstance),(void*)(offset + 9*sizeof(float)));
+    glVertexAttribPointer(5,4,GL_FLOAT,GL_FALSE,sizeof(PieceInstance),(void*)(offset + 10*sizeof(float)));
+    glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, (GLsizei)count);
+    glsCountDraw();
+}
+
+// clamps the piece's UV span to tile `t`; false if they don't overlap
+static bool clipToTile(const PuzzlePiece& p, const ImageTile& t, float& ua, float& va, float& ub, float& vb)
+{
+    ua = fminf(fmaxf(p.u0, t.u0), t.u1);
+    ub = fminf(fmaxf(p.u1, t.u0), t.u1);
+    va = fminf(fmaxf(p.v0, t.v0), t.v1);
+    vb = fminf(fmaxf(p.v1, t.v0), t.v1);
+    return ua != ub && va != vb;
+}
+
+int pieceInstanceCount(const PuzzlePiece& p)
+{
+    if (p.tile >= 0) return 1;
+    int n = 0;
+    float ua, va, ub, vb;
+    for (auto &t : tiles) n += clipToTile(p, t, ua, va, ub, vb);
+    return n;
+}
+
+// a straddling piece becomes one instance per tile it covers, each cut to the
+// part of the rect that maps onto that tile
+PieceInstance* writePieceInstances(const PuzzlePiece& p, PieceInstance* inst)
+{
+    float x0 = p.x - p.extent, y0 = p.y - p.extent, x1 = p.x + p.extent, y1 = p.y + p.extent;
+    float mu0 = (float)(p.shape % MASK_GRID) / MASK_GRID, mv0 = (float)(p.shape / MASK_GRID) / MASK_GRID;
+    float mw = 1.0f / MASK_GRID;
+    if (p.tile >= 0) {
+        *inst++ = { x0, y0, x1, y1, p.tu0, p.tv0, p.tu1, p.tv1, (float)p.tile, pieceDepth(p),
+                    mu0, mv0, mu0 + mw, mv0 + mw };
+        return inst;
+    }
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        const ImageTile &t = tiles[i];
+        float ua, va, ub, vb;
+        if (!clipToTile(p, t, ua, va, ub, vb)) continue;
+        // fractions of the padded quad this part covers
+        float fa = (ua - p.u0) / (p.u1 - p.u0), fb = (ub - p.u0) / (p.u1 - p.u0);
+        float ga = (va - p.v0) / (p.v1 - p.v0), gb = (vb - p.v0) / (p.v1 - p.v0);
+        *inst++ = {
+            x0 + fa * (x1 - x0), y0 + ga * (y1 - y0), x0 + fb * (x1 - x0), y0 + gb * (y1 - y0),
+            (ua - t.u0) / (t.u1 - t.u0), (va - t.v0) / (t.v1 - t.v0),
+            (ub - t.u0) / (t.u1 - t.u0), (vb - t.v0) / (t.v1 - t.v0),
+            (float)i, pieceDepth(p),
+            mu0 + fa * mw, mv0 + ga * mw, mu0 + fb * mw, mv0 + gb * mw
+        };
+    }
+    return inst;
+}
+
+// the cursor is read again just before the dragged piece is submitted; its
+// instances were written with the rest, so only the offset uniform changes
+// `again` reuses the last reading, so a piece drawn in two passes stays whole
+void latchDragged(bool again = false)
+{
+    static float dx = 0.0f, dy = 0.0f;
+    if (!again) {
+        const PuzzlePiece &p = (*view.pieces)[view.dragged];
+        // GLFW only reads the cursor on the main thread; the render thread takes
+        // the position stored last, and its age along with it
+        double mx = cursorX, my = cursorY;
+        dragSampleTime = cursorStamp;
+        if (!renderThread) {
+            glfwGetCursorPos(glfwGetCurrentContext(), &mx, &my);
+            dragSampleTime = now();
+        }
+        BoardView v = view;
+        // the cursor is in window pixels while --dynamic-res draws smaller
+        if (dynres.windowW) {
+            v.width = dynres.windowW;
+            v.height = dynres.windowH;
+        }
+        float wx, wy;
+        screenToWorld(v, mx, my, wx, wy);
+        dx = wx - view.grabOffsetX - p.x;
+        dy = wy - view.grabOffsetY - p.y;
+    }
+    glsUniform4f(texShaderOffset, dx, dy, 0.0f, 0.0f);
+}
+
+void drawLatched(size_t offset, size_t count, bool again = false)
+{
+    latchDragged(again);
+    drawInstances(offset, count);
+    glsUniform4f(texShaderOffset, 0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+void uploadMeshes()
+{
+    if (!meshVao) {
+        glGenVertexArrays(1, &meshVao);
+        glGenBuffers(1, &meshVbo);
+        glGenBuffers(1, &meshEbo);
+        glsBindVertexArray(meshVao);
+        glsBindBuffer(GL_ARRAY_BUFFER, meshVbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0,2,GL_FLOAT,GL_FALSE,sizeof(MeshVertex),(void*)0);
+        glEnableVertexAttribArray(6);
+        glVertexAttribPointer(6,1,GL_FLOAT,GL_FALSE,sizeof(MeshVertex),(void*)(2*sizeof(float)));
+    }
+    glsBindVertexArray(meshVao);
+    glsBindBuffer(GL_ARRAY_BUFFER, meshVbo);
+    glsBufferData(GL_ARRAY_BUFFER, meshes.vertices.size() * sizeof(MeshVertex), meshes.vertices.data(), GL_STATIC_DRAW);
+    glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshEbo);
+    glsBufferData(GL_ELEMENT_ARRAY_BUFFER, meshes.indices.size() * sizeof(uint16_t), meshes.indices.data(), GL_STATIC_DRAW);
+    meshUploaded = meshes.version;
+}
+
+// every piece is the same size on screen, so one level serves the frame
+int meshLod()
+{
+    if (view.pieces->empty()) return 0;
+    float px = (*view.pieces)[0].size * view.camera.zoom * std::max(view.width, view.height);
+    int lod = 0;
+    while (lod < MESH_LODS - 1 && px >= MESH_LOD_PIXELS[lod]) lod++;
+    return lod;
+}
+
+static const void* meshFirst(const PuzzlePiece& p, int lod)
+{
+    return (const void*)(((size_t)p.id * MESH_MAX_INDICES + 36 * ((1 << lod) - 1)) * sizeof(uint16_t));
+}
+
+// --mesh-pieces: each piece is its own mesh, so they go out as one
+// multi-draw in stacking order; the vertex stage finds a piece's rect, UVs
+// and unit in a table indexed by id, kept in the stream buffer. A piece
+// straddling a tile seam gets unit -1 and picture UVs, and the fragment
+// stage picks the tile
+void drawPieceMeshes(const std::vector<PuzzlePiece>& src, bool snapped, const PuzzlePiece* late)
+{
+    if (meshUploaded != meshes.version) uploadMeshes();
+    float x0, y0, x1, y1;
+    visibleRect(x0, y0, x1, y1);
+    int lod = meshLod();
+    if (!snapped) meshLodFrames[lod]++;
+
+    static std::vector<GLsizei> counts;
+    static std::vector<const void*> firsts;
+    static std::vector<GLint> bases;
+    counts.clear();
+    firsts.clear();
+    bases.clear();
+    size_t offset;
+    MeshInstance* table = (MeshInstance*)streamMap(meshes.counts.size() / MESH_LODS * sizeof(MeshInstance), offset);
+    forEachPiece(src, snapped, true, [&](const PuzzlePiece& p) {
+        if (!pieceVisible(p, x0, y0, x1, y1)) {
+            piecesCulled++;
+            return;
+        }
+        MeshInstance &m = table[p.id];
+        m = {p.x - p.extent, p.y - p.extent, p.x + p.extent, p.y + p.extent,
+             p.tu0, p.tv0, p.tu1, p.tv1, (float)p.tile, pieceDepth(p), {0.0f, 0.0f}};
+        if (p.tile < 0) {
+            m.u0 = p.u0;
+            m.v0 = p.v0;
+            m.u1 = p.u1;
+            m.v1 = p.v1;
+        }
+        if (&p == late) return;
+        counts.push_back(meshes.counts[(size_t)p.id * MESH_LODS + lod]);
+        firsts.push_back(meshFirst(p, lod));
+        bases.push_back(p.id * MESH_MAX_VERTS);
+    });
+    streamUnmap();
+    bool drawLate = late && pieceVisible(*late, x0, y0, x1, y1);
+    if (counts.empty() && !drawLate) return;
+
+    glsActiveTexture(GL_TEXTURE0 + MESH_TABLE_UNIT);
+    glsBindTexture(GL_TEXTURE_BUFFER, meshTable);
+    // attached every time, since the stream buffer may have been re-specified
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, stream.buffer);
+    glsUniform1i(texShaderMeshBase, (int)(offset / (4 * sizeof(float))));
+    glsUniform1i(texShaderMeshes, 1);
+    glsBindVertexArray(meshVao);
+    if (!counts.empty()) {
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_SHORT, firsts.data(),
+                                      (GLsizei)counts.size(), bases.data());
+        glsCountDraw();
+    }
+    if (drawLate) {
+        latchDragged();
+        glDrawElementsBaseVertex(GL_TRIANGLES, meshes.counts[(size_t)late->id * MESH_LODS + lod], GL_UNSIGNED_SHORT,
+                                 (void*)meshFirst(*late, lod), late->id * MESH_MAX_VERTS);
+        glsCountDraw();
+        glsUniform4f(texShaderOffset, 0.0f, 0.0f, 0.0f, 0.0f);
+    }
+    glsUniform1i(texShaderMeshes, 0);
+    glsBindVertexArray(vao);
+}
+
+void printMeshStats()
+{
+    if (!meshPieces) return;
+    printf("meshes: frames per level");
+    for (int i = 0; i < MESH_LODS; ++i) printf(" %d:%lu", i, meshLodFrames[i]);
+    printf("\n");
+}
+
+void printStackStats()
+{
+    unsigned long frames = stackFrames[0] + stackFrames[1];
+    if (meshPieces || frames == 0) return;
+    printf("stack: %lu of %lu frames depth tested, quads cover their box %.2fx on average\n",
+           stackFrames[1], frames, stackOverdraw / frames);
+}
+
+// a block of instances in the stream buffer, the late-latched piece's last.
+// Live pieces are depth tested (`stacked`) when their quads pile up enough
+// (see STACK_OVERDRAW): then the block is written top down and followed by
+// a bottom-up copy at `rimOffset` for the rims, which blend in order.
+// Otherwise it is written bottom up
+struct PieceBatch {
+    size_t offset, rimOffset, count, lateCount;
+    bool stacked;
+};
+PieceBatch writePieces(const std::vector<PuzzlePiece>& src, bool snapped, const PuzzlePiece* late)
+{
+    float x0, y0, x1, y1;
+    visibleRect(x0, y0, x1, y1);
+    PieceBatch b = {0, 0, 0, 0, false};
+    // summed on-screen quad area, and the box around it
+    float area = 0.0f, bx0 = x1, by0 = y1, bx1 = x0, by1 = y0;
+    int visible = 0;
+    for (auto &p : src) {
+        if (p.snapped != snapped) continue;
+        if (!pieceVisible(p, x0, y0, x1, y1)) {
+            piecesCulled++;
+            continue;
+        }
+        if (&p == late) b.lateCount = pieceInstanceCount(p);
+        else b.count += pieceInstanceCount(p);
+        if (!boards.empty()) boards[p.board].instances++;
+        float qx0 = fmaxf(p.x - p.extent, x0), qy0 = fmaxf(p.y - p.extent, y0);
+        float qx1 = fminf(p.x + p.extent, x1), qy1 = fminf(p.y + p.extent, y1);
+        area += (qx1 - qx0) * (qy1 - qy0);
+        visible++;
+        bx0 = fminf(bx0, qx0);
+        by0 = fminf(by0, qy0);
+        bx1 = fmaxf(bx1, qx1);
+        by1 = fmaxf(by1, qy1);
+    }
+    if (b.count + b.lateCount == 0) return b;
+    if (!snapped && &src == view.pieces) {
+        float overdraw = area / ((bx1 - bx0) * (by1 - by0));
+        float quadPixels = area / visible * view.width * view.height / ((x1 - x0) * (y1 - y0));
+        b.stacked = overdraw >= STACK_OVERDRAW && quadPixels >= STACK_QUAD_PIXELS;
+        stackFrames[b.stacked]++;
+        stackOverdraw += overdraw;
+    }
+
+    size_t block = (b.count + b.lateCount) * sizeof(PieceInstance);
+    PieceInstance* inst = (PieceInstance*)streamMap(b.stacked ? 2 * block : block, b.offset);
+    for (int pass = 0; pass < (b.stacked ? 2 : 1); ++pass) {
+        forEachPiece(src, snapped, b.stacked && pass == 0, [&](const PuzzlePiece& p) {
+            if (&p != late && pieceVisible(p, x0, y0, x1, y1)) inst = writePieceInstances(p, inst);
+        });
+        if (b.lateCount) inst = writePieceInstances(*late, inst);
+    }
+    streamUnmap();
+    b.rimOffset = b.offset + block;
+    return b;
+}
+// the rim pass puts the late-latched piece where the first pass did
+void drawBatch(const PieceBatch& b, bool rims = false)
+{
+    size_t offset = rims ? b.rimOffset : b.offset;
+    if (b.count) drawInstances(offset, b.count);
+    if (b.lateCount) drawLatched(offset + b.count * sizeof(PieceInstance), b.lateCount, rims);
+}
+// draws every on-screen piece in `src` whose snapped flag equals `snapped`;
+// all tiles are bound at once so stacking order survives a single draw
+void drawPieces(const std::vector<PuzzlePiece>& src, bool snapped)
+{
+    if (meshPieces) {
+        drawPieceMeshes(src, snapped, NULL);
+        return;
+    }
+    PieceBatch b = writePieces(src, snapped, NULL);
+    // mask edges are anti-aliased, so pieces blend (premultiplied) like the layer
+    glsBlend(true);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    drawBatch(b);
+    glsBlend(false);
+}
+
+// sleeps away the part of the refresh interval the frame doesn't need, so
+// input is sampled closer to the swap that shows it
+void frameDelaySleep(double workStart, double workEnd)
+{
+    double t = now();
+    if (delay.lastSwap > 0.0) {
+        double interval = t - delay.lastSwap;
+        double work = workEnd - workStart;
+        delay.refresh += (interval - delay.refresh) * FRAME_DELAY_SMOOTHING;
+        // grow the work estimate at once, shrink it slowly
+        delay.work = work > delay.work ? work : delay.work + (work - delay.work) * FRAME_DELAY_SMOOTHING;
+    } else {
+        delay.refresh = 1.0 / 60.0;
+    }
+    delay.lastSwap = t;
+
+    double sleep = delay.refresh - delay.work - FRAME_DELAY_MARGIN;
+    if (sleep > 0.0) std::this_thread::sleep_for(std::chrono::duration<double>(sleep));
+}
+
+void applySwapInterval()
+{
+    int interval = vsync == VSYNC_OFF ? 0 : 1;
+    if (vsync == VSYNC_ADAPTIVE) {
+        if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+            interval = -1;
+        } else {
+            fprintf(stderr, "pacing: no EXT_swap_control_tear, using plain vsync\n");
+            vsync = VSYNC_ON;
+        }
+    }
+    glfwSwapInterval(interval);
+}
+
+// called once per presented frame; with a cap it waits for the frame's
+// deadline, and a frame that is already late moves the schedule instead of
+// being followed by a burst of catch-up frames
+void paceFrame()
+{
+    double t = now();
+    if (pacer.interval > 0.0) {
+        pacer.deadline += pacer.interval;
+        if (t >= pacer.deadline) {
+            // after an idle gap the deadline is simply restarted
+            if (pacer.last > 0.0 && t - pacer.last < PACE_GAP) pacer.missed++;
+            pacer.deadline = t;
+        } else {
+            double wake = pacer.deadline - pacer.overshoot - PACE_SPIN;
+            if (wake > t) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(wake - t));
+                double over = now() - wake;
+                // grow at once, shrink slowly
+                over = fmin(over, PACE_OVERSHOOT_MAX);
+                pacer.overshoot = over > pacer.overshoot ? over
+                                : pacer.overshoot + (over - pacer.overshoot) * PACE_OVERSHOOT_DECAY;
+            }
+            while ((t = now()) < pacer.deadline) std::this_thread::yield();
+        }
+    }
+
+    double frame = t - pacer.last;
+    if (pacer.last > 0.0 && frame < PACE_GAP) {
+        pacer.frames++;
+        pacer.sum += frame;
+        pacer.sumSq += frame * frame;
+        if (fabs(frame - pacer.interval) <= PACE_TOLERANCE) pacer.onTarget++;
+    }
+    pacer.last = t;
+}
+
+void printPacingStats()
+{
+    if (pacer.frames == 0) return;
+    double mean = pacer.sum / pacer.frames;
+    double var = fmax(pacer.sumSq / pacer.frames - mean * mean, 0.0);
+    const char* modes[] = {"on", "off", "adaptive"};
+    printf("pacing: vsync %s, ", modes[vsync]);
+    if (pacer.interval > 0.0)
+        printf("cap %.1f fps: %lu frames, %.3f ms avg, %.3f ms stddev, %.1f%% within %.1f ms of target, %lu missed, "
+               "%.3f ms spin\n", 1.0 / pacer.interval, pacer.frames, mean * 1000.0, sqrt(var) * 1000.0,
+               100.0 * pacer.onTarget / pacer.frames, PACE_TOLERANCE * 1000.0, pacer.missed,
+               (pacer.overshoot + PACE_SPIN) * 1000.0);
+    else
+        printf("uncapped: %lu frames, %.3f ms avg, %.3f ms stddev\n", pacer.frames, mean * 1000.0, sqrt(var) * 1000.0);
+}
+
+void latencyAdd(LatencyHistogram& h, double ms)
+{
+    int b = (int)(ms / LATENCY_BUCKET_MS);
+    h.counts[std::min(std::max(b, 0), LATENCY_BUCKETS - 1)]++;
+    h.samples++;
+    h.sum += ms;
+}
+
+// the p99 is the top of its bucket
+void printLatencyStats()
+{
+    const LatencyHistogram &h = dragLatency;
+    if (h.samples == 0) return;
+    unsigned long rank = h.samples * 99 / 100, seen = 0;
+    int b = 0;
+    while (b < LATENCY_BUCKETS - 1 && (seen += h.counts[b]) <= rank) b++;
+    printf("latency: %lu drag frames, input to swap %.2f ms avg, %.2f ms p99 (late latch %s, frame delay %s)\n",
+           h.samples, h.sum / h.samples, (b + 1) * LATENCY_BUCKET_MS, lowLatency ? "on" : "off",
+           frameDelay ? "on" : "off");
+}
+
+void bindTiles()
+{
+    glsActiveTexture(GL_TEXTURE0 + MASK_UNIT);
+    glsBindTexture(GL_TEXTURE_2D, maskAtlas);
+    if (pictureArray) {
+        glsActiveTexture(GL_TEXTURE0 + PICTURE_ARRAY_UNIT);
+        glsBindTexture(GL_TEXTURE_2D_ARRAY, pictureArray);
+    }
+    if (vt.active) {
+        glsActiveTexture(GL_TEXTURE0 + VT_CACHE_UNIT);
+        glsBindTexture(GL_TEXTURE_2D, vt.cache);
+        glsActiveTexture(GL_TEXTURE0 + VT_TABLE_UNIT);
+        glsBindTexture(GL_TEXTURE_2D, vt.tableTex);
+        return;
+    }
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        glsActiveTexture(GL_TEXTURE0 + (GLenum)i);
+        glsBindTexture(GL_TEXTURE_2D, tiles[i].texture);
+    }
+}
+
+void invalidateBoardLayer()
+{
+    boardValid = false;
+    boardQueue.clear();
+}
+
+// the world rect around every board
+void boardsRect(float& x0, float& y0, float& x1, float& y1)
+{
+    x0 = y0 = -BOARD_HALF;
+    x1 = y1 = BOARD_HALF;
+    for (const Board &b : boards) {
+        x0 = fminf(x0, b.x - BOARD_HALF);
+        y0 = fminf(y0, b.y - BOARD_HALF);
+        x1 = fmaxf(x1, b.x + BOARD_HALF);
+        y1 = fmaxf(y1, b.y + BOARD_HALF);
+    }
+}
+
+// brings the baked layer up to date: a full rebuild after resize, reload or a
+// change of zoom level, otherwise only the pieces that snapped since the last
+// frame. The render thread gets no queue, so snaps it sees only by count
+// rebuild too
+void updateBoardLayer()
+{
+    if (view.width < 1 || view.height < 1) return;
+
+    // a square around the boards, so one camera zoom frames it
+    float x0, y0, x1, y1;
+    boardsRect(x0, y0, x1, y1);
+    float side = fmaxf(x1 - x0, y1 - y0);
+    float zoom = exp2f(ceilf(log2f(view.camera.zoom) - 1e-4f));
+    int w = (int)ceilf(side * zoom * 0.5f * view.width);
+    int h = (int)ceilf(side * zoom * 0.5f * view.height);
+    boardDirect = std::max(w, h) > BOARD_LAYER_MAX;
+    if (boardDirect) {
+        invalidateBoardLayer();
+        return;
+    }
+    bakedCamera = {(x0 + x1) * 0.5f, (y0 + y1) * 0.5f, 2.0f / side};
+
+    if (view.snaps != bakedSnaps && boardQueue.empty()) boardValid = false;
+    bakedSnaps = view.snaps;
+
+    if (!boardFbo) {
+        glGenFramebuffers(1, &boardFbo);
+        glGenTextures(1, &boardTex);
+    }
+    if (w != boardW || h != boardH) {
+        boardW = w;
+        boardH = h;
+        glsActiveTexture(GL_TEXTURE0 + LAYER_UNIT);
+        glsBindTexture(GL_TEXTURE_2D, boardTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glsBindFramebuffer(boardFbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, boardTex, 0);
+        boardValid = false;
+    }
+    if (boardValid && boardQueue.empty()) return;
+
+    glsBindFramebuffer(boardFbo);
+    glsViewport(0, 0, boardW, boardH);
+    // the layer must not be bound while it is the render target
+    glsActiveTexture(GL_TEXTURE0 + LAYER_UNIT);
+    glsBindTexture(GL_TEXTURE_2D, 0);
+    bindTiles();
+    // drawn through the baking camera, which also culls to the layer
+    Camera live = view.camera;
+    int liveW = view.width, liveH = view.height;
+    view.camera = bakedCamera;
+    view.width = boardW;
+    view.height = boardH;
+    setCameraXform();
+
+    if (!boardValid) {
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        drawPieces(*view.pieces, true);
+        boardSnapped = 0;
+        for (auto &p : *view.pieces) boardSnapped += p.snapped;
+        boardValid = true;
+    } else {
+        drawPieces(boardQueue, true);
+        boardSnapped += (int)boardQueue.size();
+    }
+    boardQueue.clear();
+    view.camera = live;
+    view.width = liveW;
+    view.height = liveH;
+
+    // zoomed out past the layer's level, it is minified
+    glsActiveTexture(GL_TEXTURE0 + LAYER_UNIT);
+    glsBindTexture(GL_TEXTURE_2D, boardTex);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glsBindFramebuffer(screenFbo);
+    glsViewport(0, 0, view.width, view.height);
+}
+
+void drawBoardLayer()
+{
+    if (boardDirect || boardSnapped == 0) return;
+
+    // only the on-screen part of the boards
+    float x0, y0, x1, y1, bx0, by0, bx1, by1;
+    visibleRect(x0, y0, x1, y1);
+    boardsRect(bx0, by0, bx1, by1);
+    x0 = fmaxf(x0, bx0);
+    y0 = fmaxf(y0, by0);
+    x1 = fminf(x1, bx1);
+    y1 = fminf(y1, by1);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    const Camera &c = bakedCamera;
+    float z = c.zoom * 0.5f;
+    size_t offset;
+    PieceInstance* inst = (PieceInstance*)streamMap(sizeof(PieceInstance), offset);
+    *inst = {
+        x0, y0, x1, y1,
+        (x0 - c.x) * z + 0.5f, (y0 - c.y) * z + 0.5f,
+        (x1 - c.x) * z + 0.5f, (y1 - c.y) * z + 0.5f,
+        // half a key: in front of the cleared depth, behind every piece
+        (float)LAYER_UNIT, 0.5f / DEPTH_KEYS,
+        MASK_SOLID, MASK_SOLID, MASK_SOLID, MASK_SOLID
+    };
+    streamUnmap();
+
+    // unsnapped areas of the layer are transparent
+    glsBlend(true);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glsActiveTexture(GL_TEXTURE0 + LAYER_UNIT);
+    glsBindTexture(GL_TEXTURE_2D, boardTex);
+    drawInstances(offset, 1);
+    glsBlend(false);
+}
+
+// unsnapped pieces over a stacked board are depth tested on their stacking
+// keys. Fully covered fragments go first, top piece first, so anything under
+// them fails the test before it is shaded; the board layer then fills what
+// they leave and the anti-aliased rims blend on last, bottom up. The rim
+// pass rasterizes every piece again, so a sparse board is just blended
+// bottom up instead. Meshes have no rims and are always depth tested. Without
+// a layer the snapped pieces are drawn first, untested, under all of it
+void drawStack()
+{
+    const PuzzlePiece* late = NULL;
+    if (lowLatency && !headless && view.dragged != -1) late = &(*view.pieces)[view.dragged];
+    if (boardDirect) drawPieces(*view.pieces, true);
+    if (meshPieces) {
+        glsDepthTest(true);
+        drawPieceMeshes(*view.pieces, false, late);
+        glsDepthMask(false);
+        drawBoardLayer();
+    } else {
+        PieceBatch b = writePieces(*view.pieces, false, late);
+        if (!b.stacked) {
+            drawBoardLayer();
+            glsBlend(true);
+            glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            drawBatch(b);
+            glsBlend(false);
+            return;
+        }
+        glsDepthTest(true);
+        glsUniform1i(texShaderCoverage, COVER_OPAQUE);
+        drawBatch(b);
+        glsDepthMask(false);
+        drawBoardLayer();
+        glsUniform1i(texShaderCoverage, COVER_RIM);
+        glsBlend(true);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        drawBatch(b, true);
+        glsBlend(false);
+        glsUniform1i(texShaderCoverage, COVER_ALL);
+    }
+    glsDepthMask(true);
+    glsDepthTest(false);
+}
+
+bool profiling()
+{
+    return profiler.overlay || profiler.json;
+}
+
+void profAdd(ProfileSection s, double start)
+{
+    profiler.current[s] += (uint64_t)((now() - start) * 1e9);
+}
+
+struct ProfileScope {
+    ProfileSection section;
+    double start;
+    ProfileScope(ProfileSection s) : section(s), start(now()) {}
+    ~ProfileScope() { profAdd(section, start); }
+};
+
+void profGpuBegin(ProfileSection s)
+{
+    if (!profiling() || softwareBackend) return;
+    int i = s - PROF_FIRST_GPU;
+    if (!profiler.queries[0][0]) glGenQueries(2 * PROF_GPU_SECTIONS, &profiler.queries[0][0]);
+    glBeginQuery(GL_TIME_ELAPSED, profiler.queries[profiler.set][i]);
+    profiler.issued[profiler.set][i] = true;
+    profiler.queryOpen = true;
+}
+
+void profGpuEnd()
+{
+    if (!profiler.queryOpen) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    profiler.queryOpen = false;
+}
+
+float profAverage(int s)
+{
+    size_t n = std::min<unsigned long>(profiler.frames, PROFILE_FRAMES);
+    if (n == 0) return 0.0f;
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) sum += profiler.history[s][i];
+    return sum / n;
+}
+
+float profWorst(int s)
+{
+    size_t n = std::min<unsigned long>(profiler.frames, PROFILE_FRAMES);
+    float worst = 0.0f;
+    for (size_t i = 0; i < n; ++i) worst = fmaxf(worst, profiler.history[s][i]);
+    return worst;
+}
+
+void printProfileJson()
+{
+    printf("{\"frames\": %lu, \"window\": %d, \"gpu_missed\": %lu",
+           profiler.frames, PROFILE_FRAMES, profiler.gpuMissed);
+    if (dynres.target > 0.0f) printf(", \"scale\": %.2f", dynResScale());
+    for (int s = 0; s < PROF_SECTIONS; ++s)
+        printf(", \"%s\": {\"avg_ms\": %.4f, \"max_ms\": %.4f}", PROFILE_NAMES[s], profAverage(s), profWorst(s));
+    printf("}\n");
+    fflush(stdout);
+}
+
+// called once per presented frame: CPU sections are stored as they are, the
+// GPU ones from the other query set, which the previous frame issued
+void profFrameEnd()
+{
+    int slot = profiler.frames % PROFILE_FRAMES;
+    for (int s = 0; s < PROF_FIRST_GPU; ++s) {
+        profiler.history[s][slot] = (float)(profiler.current[s].exchange(0) / 1e6);
+    }
+
+    int prev = profiler.set ^ 1;
+    for (int i = 0; i < PROF_GPU_SECTIONS; ++i) {
+        float ms = 0.0f;
+        if (profiler.issued[prev][i]) {
+            GLint available = 0;
+            glGetQueryObjectiv(profiler.queries[prev][i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(profiler.queries[prev][i], GL_QUERY_RESULT, &ns);
+                ms = (float)(ns / 1e6);
+            } else {
+                // keep the last value rather than wait for the GPU
+                profiler.gpuMissed++;
+                ms = profiler.history[PROF_FIRST_GPU + i][(slot + PROFILE_FRAMES - 1) % PROFILE_FRAMES];
+            }
+            profiler.issued[prev][i] = false;
+        }
+        profiler.history[PROF_FIRST_GPU + i][slot] = ms;
+    }
+    profiler.set = prev;
+    profiler.frames++;
+
+    if (profiler.json && profiler.frames % PROFILE_FRAMES == 0) printProfileJson();
+}
+
+// 3x5 pixel glyphs, one bit per pixel, top row in the high bits
+struct Glyph {
+    char c;
+    uint16_t bits;
+};
+
+const Glyph OVERLAY_FONT[] = {
+    {'0', 0x7B6F}, {'1', 0x2C97}, {'2', 0x73E7}, {'3', 0x73CF}, {'4', 0x5BC9},
+    {'5', 0x79CF}, {'6', 0x79EF}, {'7', 0x7292}, {'8', 0x7BEF}, {'9', 0x7BCF},
+    {'.', 0x0002}, {'A', 0x2BED}, {'C', 0x3923}, {'D', 0x6B6E}, {'E', 0x79A7},
+    {'F', 0x79A4}, {'G', 0x396B}, {'H', 0x5BED}, {'I', 0x7497}, {'L', 0x4927},
+    {'M', 0x5FED}, {'N', 0x6B6D}, {'O', 0x2B6A}, {'P', 0x6BA4}, {'R', 0x6BAD},
+    {'S', 0x388E}, {'T', 0x7492}, {'U', 0x5B6F}, {'V', 0x5B6A}, {'W', 0x5BFD},
+    {'X', 0x5AAD}
+};
+
+const float OVERLAY_PIXEL = 2.0f;
+const float OVERLAY_BAR = 120.0f;
+const float OVERLAY_BAR_MS = 1000.0f / 60.0f;
+
+PieceInstance overlayRect(float x0, float y0, float x1, float y1)
+{
+    return {x0, y0, x1, y1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+}
+
+// each row of a glyph becomes one rect per run of set pixels
+void overlayText(std::vector<PieceInstance>& out, float x, float y, const char* text)
+{
+    const float px = OVERLAY_PIXEL;
+    for (; *text; ++text, x += 4 * px) {
+        uint16_t bits = 0;
+        for (const Glyph& g : OVERLAY_FONT)
+            if (g.c == *text) bits = g.bits;
+        for (int row = 0; row < 5; ++row) {
+            int mask = (bits >> (12 - row * 3)) & 7;
+            for (int col = 0; col < 3;) {
+                if (!(mask & (4 >> col))) { ++col; continue; }
+                int end = col;
+                while (end < 3 && (mask & (4 >> end))) ++end;
+                out.push_back(overlayRect(x + col * px, y + row * px, x + end * px, y + (row + 1) * px));
+                col = end;
+            }
+        }
+    }
+}
+
+void overlayRects(const std::vector<PieceInstance>& rects, float r, float g, float b, float a)
+{
+    if (rects.empty()) return;
+    size_t offset;
+    void* dst = streamMap(rects.size() * sizeof(PieceInstance), offset);
+    memcpy(dst, rects.data(), rects.size() * sizeof(PieceInstance));
+    streamUnmap();
+    // premultiplied, to match the board layer's blend function
+    glsUniform4f(overlayColor, r * a, g * a, b * a, a);
+    drawInstances(offset, rects.size());
+}
+
+// averages and worst frame per section; bars are scaled to a 60 Hz frame
+void drawProfileOverlay()
+{
+    const float line = 7 * OVERLAY_PIXEL;
+    const float x = 8.0f, y = 8.0f;
+    const float barX = x + 8 + 24 * 4 * OVERLAY_PIXEL;
+
+    int rows = PROF_SECTIONS + 1 + (dynres.target > 0.0f);
+
+    std::vector<PieceInstance> panel, text, cpuBars, gpuBars, worst;
+    panel.push_back(overlayRect(x, y, barX + OVERLAY_BAR + 8, y + 8 + rows * line));
+    overlayText(text, x + 4, y + 4, "SECTION       AVG    MAX");
+    for (int s = 0; s < PROF_SECTIONS; ++s) {
+        char buf[64];
+        float avg = profAverage(s), max = profWorst(s);
+        float ly = y + 4 + (s + 1) * line;
+        snprintf(buf, sizeof(buf), "%-10s %6.2f %6.2f", PROFILE_LABELS[s], avg, max);
+        overlayText(text, x + 4, ly, buf);
+        float w = fminf(avg / OVERLAY_BAR_MS, 1.0f) * OVERLAY_BAR;
+        float m = fminf(max / OVERLAY_BAR_MS, 1.0f) * OVERLAY_BAR;
+        (s < PROF_FIRST_GPU ? cpuBars : gpuBars).push_back(overlayRect(barX, ly, barX + w, ly + 5 * OVERLAY_PIXEL));
+        worst.push_back(overlayRect(barX + m - 1, ly, barX + m + 1, ly + 5 * OVERLAY_PIXEL));
+    }
+    if (dynres.target > 0.0f) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%-10s %6.2f", "RES SCALE", dynResScale());
+        overlayText(text, x + 4, y + 4 + (rows - 1) * line, buf);
+    }
+
+    glsUseProgram(overlayShader);
+    glsUniform4f(overlayXform, 2.0f / view.width, -2.0f / view.height, -1.0f, 1.0f);
+    glsBlend(true);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    overlayRects(panel, 0.0f, 0.0f, 0.0f, 0.7f);
+    overlayRects(cpuBars, 0.3f, 0.8f, 1.0f, 1.0f);
+    overlayRects(gpuBars, 1.0f, 0.6f, 0.2f, 1.0f);
+    overlayRects(worst, 1.0f, 0.2f, 0.2f, 1.0f);
+    overlayRects(text, 1.0f, 1.0f, 1.0f, 1.0f);
+    glsBlend(false);
+    glsUseProgram(texShader);
+}
+
+// redraws every piece touching world rect `r` into the bound minimap: the
+// snapped ones first, then the loose ones bottom up, as on the board.
+// Returns how many pieces that was
+int minimapDrawRect(const MapRect& r)
+{
+    const std::vector<PuzzlePiece> &src = *view.pieces;
+    size_t count = 0;
+    int drawn = 0;
+    for (auto &p : src)
+        if (pieceVisible(p, r.x0, r.y0, r.x1, r.y1)) count += pieceInstanceCount(p);
+    if (count == 0) return 0;
+    size_t offset;
+    PieceInstance* inst = (PieceInstance*)streamMap(count * sizeof(PieceInstance), offset);
+    for (int snapped = 1; snapped >= 0; --snapped) {
+        forEachPiece(src, snapped, false, [&](const PuzzlePiece& p) {
+            if (!pieceVisible(p, r.x0, r.y0, r.x1, r.y1)) return;
+            inst = writePieceInstances(p, inst);
+            drawn++;
+        });
+    }
+    streamUnmap();
+    drawInstances(offset, count);
+    return drawn;
+}
+
+// lays the table out again after a reload or resize; the minimap covers every
+// board out to where pieces can be scattered
+void minimapResize(int side)
+{
+    float extent = 0.0f;
+    for (auto &p : *view.pieces) extent = fmaxf(extent, p.extent);
+    float half = SCATTER_HALF + extent;
+    minimap.x0 = minimap.y0 = -half;
+    minimap.x1 = minimap.y1 = half;
+    for (const Board &b : boards) {
+        minimap.x0 = fminf(minimap.x0, b.x - half);
+        minimap.y0 = fminf(minimap.y0, b.y - half);
+        minimap.x1 = fmaxf(minimap.x1, b.x + half);
+        minimap.y1 = fmaxf(minimap.y1, b.y + half);
+    }
+    float tw = minimap.x1 - minimap.x0, th = minimap.y1 - minimap.y0;
+    minimap.side = side;
+    minimap.w = std::max(1, (int)(side * tw / fmaxf(tw, th)));
+    minimap.h = std::max(1, (int)(side * th / fmaxf(tw, th)));
+
+    if (!minimap.fbo) {
+        glGenFramebuffers(1, &minimap.fbo);
+        glGenTextures(1, &minimap.texture);
+    }
+    glsActiveTexture(GL_TEXTURE0 + LAYER_UNIT);
+    glsBindTexture(GL_TEXTURE_2D, minimap.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, minimap.w, minimap.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glsBindTexture(GL_TEXTURE_2D, 0);
+    glsBindFramebuffer(minimap.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, minimap.texture, 0);
+}
+
+// applies the view's dirty rects, each scissored to the pixels it covers
+// (grown by one for the filtered edges); a new board or size redraws it all
+void updateMinimap()
+{
+    if (!minimapEnabled || view.width < 1 || view.height < 1) return;
+    int side = std::min(MINIMAP_SIZE, std::min(view.width, view.height) / 3);
+    bool full = !minimap.fbo || side != minimap.side || view.generation != minimap.generation;
+    std::vector<MapRect> &dirty = *view.dirty;
+    if (!full && dirty.empty()) return;
+
+    // the minimap must not be bound while it is the render target
+    glsActiveTexture(GL_TEXTURE0 + LAYER_UNIT);
+    glsBindTexture(GL_TEXTURE_2D, 0);
+    if (full) minimapResize(std::max(side, 1));
+    glsBindFramebuffer(minimap.fbo);
+    glsViewport(0, 0, minimap.w, minimap.h);
+    bindTiles();
+    float tw = minimap.x1 - minimap.x0, th = minimap.y1 - minimap.y0;
+    setXform(2.0f / tw, 2.0f / th, -(minimap.x0 + minimap.x1) / tw, -(minimap.y0 + minimap.y1) / th);
+    glClearColor(0.12f, 0.12f, 0.12f, 0.75f);
+    glsBlend(true);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    if (full) {
+        glClear(GL_COLOR_BUFFER_BIT);
+        minimapDrawRect({minimap.x0, minimap.y0, minimap.x1, minimap.y1});
+        minimap.generation = view.generation;
+        minimap.refreshes++;
+    } else {
+        float sx = minimap.w / tw, sy = minimap.h / th;
+        glEnable(GL_SCISSOR_TEST);
+        for (const MapRect &r : dirty) {
+            int px0 = std::max(0, (int)floorf((r.x0 - minimap.x0) * sx) - 1);
+            int py0 = std::max(0, (int)floorf((r.y0 - minimap.y0) * sy) - 1);
+            int px1 = std::min(minimap.w, (int)ceilf((r.x1 - minimap.x0) * sx) + 1);
+            int py1 = std::min(minimap.h, (int)ceilf((r.y1 - minimap.y0) * sy) + 1);
+            if (px0 >= px1 || py0 >= py1) continue;
+            glScissor(px0, py0, px1 - px0, py1 - py0);
+            glClear(GL_COLOR_BUFFER_BIT);
+            // everything reaching into the scissored pixels, not just the rect
+            minimap.pieces += minimapDrawRect({minimap.x0 + px0 / sx, minimap.y0 + py0 / sy,
+                                               minimap.x0 + px1 / sx, minimap.y0 + py1 / sy});
+        }
+        glDisable(GL_SCISSOR_TEST);
+        minimap.updates++;
+        minimap.rects += dirty.size();
+    }
+    glsBlend(false);
+    dirty.clear();
+
+    glsBindFramebuffer(screenFbo);
+    glsViewport(0, 0, view.width, view.height);
+}
+
+// the minimap in the bottom right corner, with the camera's view outlined
+void drawMinimap()
+{
+    if (!minimapEnabled || !minimap.fbo) return;
+    float x1 = view.width - MINIMAP_MARGIN, y1 = view.height - MINIMAP_MARGIN;
+    float x0 = x1 - minimap.w, y0 = y1 - minimap.h;
+    size_t offset;
+    PieceInstance* inst = (PieceInstance*)streamMap(sizeof(PieceInstance), offset);
+    // pixels run down the screen, the minimap's rows up
+    *inst = {x0, y0, x1, y1, 0.0f, 1.0f, 1.0f, 0.0f, (float)LAYER_UNIT, 0.0f,
+             MASK_SOLID, MASK_SOLID, MASK_SOLID, MASK_SOLID};
+    streamUnmap();
+    setXform(2.0f / view.width, -2.0f / view.height, -1.0f, 1.0f);
+    glsBlend(true);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glsActiveTexture(GL_TEXTURE0 + LAYER_UNIT);
+    glsBindTexture(GL_TEXTURE_2D, minimap.texture);
+    drawInstances(offset, 1);
+
+    float vx0, vy0, vx1, vy1;
+    visibleRect(vx0, vy0, vx1, vy1);
+    float sx = minimap.w / (minimap.x1 - minimap.x0), sy = minimap.h / (minimap.y1 - minimap.y0);
+    float fx0 = fmaxf(x0 + (vx0 - minimap.x0) * sx, x0), fx1 = fminf(x0 + (vx1 - minimap.x0) * sx, x1);
+    float fy0 = fmaxf(y1 - (vy1 - minimap.y0) * sy, y0), fy1 = fminf(y1 - (vy0 - minimap.y0) * sy, y1);
+    if (fx0 < fx1 && fy0 < fy1) {
+        std::vector<PieceInstance> frame = {
+            overlayRect(fx0, fy0, fx1, fy0 + 1), overlayRect(fx0, fy1 - 1, fx1, fy1),
+            overlayRect(fx0, fy0, fx0 + 1, fy1), overlayRect(fx1 - 1, fy0, fx1, fy1),
+        };
+        glsUseProgram(overlayShader);
+        glsUniform4f(overlayXform, 2.0f / view.width, -2.0f / view.height, -1.0f, 1.0f);
+        overlayRects(frame, 1.0f, 1.0f, 1.0f, 0.8f);
+        glsUseProgram(texShader);
+    }
+    glsBlend(false);
+    setCameraXform();
+}
+
+void printMinimapStats()
+{
+    if (!minimapEnabled || minimap.refreshes == 0) return;
+    printf("minimap: %lu full redraws, %lu updates of %.1f rects and %.1f pieces on average\n",
+           minimap.refreshes, minimap.updates, minimap.updates ? (double)minimap.rects / minimap.updates : 0.0,
+           minimap.updates ? (double)minimap.pieces / minimap.updates : 0.0);
+}
+
+// the size the board is drawn at this frame
+void dynResSize(int& w, int& h)
+{
+    if (dynres.target <= 0.0f) return;
+    w = std::max(1, (int)(w * dynResScale() + 0.5f));
+    h = std::max(1, (int)(h * dynResScale() + 0.5f));
+}
+
+// fill cost goes with the pixel count, so the scale follows the square root
+// of target over time. It drops as soon as a frame is over the target but
+// only grows again with 20% to spare, and new timings settle after a change
+void dynResAdjust(float ms)
+{
+    DynamicRes &d = dynres;
+    d.frames++;
+    d.levelSum += d.level;
+    d.msSum += ms;
+    d.smoothed = d.samples++ ? d.smoothed + (ms - d.smoothed) * 0.2f : ms;
+    if (d.samples < DYNRES_SETTLE) return;
+    float want = d.level * sqrtf(d.target / fmaxf(d.smoothed, 0.01f));
+    int next = std::min(DYNRES_STEPS, std::max(DYNRES_STEPS / 2, (int)want));
+    if (next == d.level || (next > d.level && d.smoothed > d.target * 0.8f)) return;
+    d.level = next;
+    d.samples = 0;
+    d.changes++;
+}
+
+// the target has the window's size; smaller scales use its bottom left part
+void dynResResize(int w, int h)
+{
+    DynamicRes &d = dynres;
+    if (!d.fbo) {
+        glGenFramebuffers(1, &d.fbo);
+        glGenRenderbuffers(1, &d.color);
+        glGenRenderbuffers(1, &d.depth);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, d.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glBindRenderbuffer(GL_RENDERBUFFER, d.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+    glsBindFramebuffer(d.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, d.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, d.depth);
+    glsBindFramebuffer(screenFbo);
+    d.w = w;
+    d.h = h;
+}
+
+// feeds last frame's time to the scale and starts timing this one: the
+// larger of its GPU time and the CPU time it took to submit
+void dynResFrameBegin()
+{
+    DynamicRes &d = dynres;
+    if (d.target <= 0.0f) return;
+    d.started = now();
+    if (d.cpuTimed) return;
+    if (!d.queries[0][0]) glGenQueries(4, &d.queries[0][0]);
+    int prev = d.set ^ 1;
+    if (d.issued[prev]) {
+        GLint available = 0;
+        glGetQueryObjectiv(d.queries[prev][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 t0 = 0, t1 = 0;
+            glGetQueryObjectui64v(d.queries[prev][0], GL_QUERY_RESULT, &t0);
+            glGetQueryObjectui64v(d.queries[prev][1], GL_QUERY_RESULT, &t1);
+            dynResAdjust(fmaxf((float)((t1 - t0) / 1e6), d.submitMs[prev]));
+        } else {
+            // rather than wait for the GPU
+            d.missed++;
+        }
+        d.issued[prev] = false;
+    }
+    glQueryCounter(d.queries[d.set][0], GL_TIMESTAMP);
+}
+
+void dynResFrameEnd()
+{
+    DynamicRes &d = dynres;
+    if (d.target <= 0.0f) return;
+    if (d.cpuTimed) {
+        glFinish();
+        dynResAdjust((float)((now() - d.started) * 1000.0));
+        return;
+    }
+    glQueryCounter(d.queries[d.set][1], GL_TIMESTAMP);
+    d.issued[d.set] = true;
+    d.submitMs[d.set] = (float)((now() - d.started) * 1000.0);
+    d.set ^= 1;
+}
+
+// shrinks the view to this frame's size; false when the board is drawn
+// straight to the window
+bool dynResBegin()
+{
+    DynamicRes &d = dynres;
+    if (d.target <= 0.0f || d.level == DYNRES_STEPS) return false;
+    if (view.width != d.w || view.height != d.h) dynResResize(view.width, view.height);
+    d.windowW = view.width;
+    d.windowH = view.height;
+    dynResSize(view.width, view.height);
+    return true;
+}
+
+// stretches the board to the window in one linear blit and restores the view
+void dynResUpscale(const BoardView& v)
+{
+    glsBindFramebuffer(screenFbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, dynres.fbo);
+    glBlitFramebuffer(0, 0, view.width, view.height, 0, 0, v.width, v.height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, screenFbo);
+    view.width = v.width;
+    view.height = v.height;
+    dynres.windowW = dynres.windowH = 0;
+    glsViewport(0, 0, view.width, view.height);
+}
+
+void printDynamicResStats()
+{
+    const DynamicRes &d = dynres;
+    if (d.target <= 0.0f || d.frames == 0) return;
+    printf("dynamic-res: target %.2f ms, frame %.2f ms and scale %.2f on average, %.2f at exit, "
+           "%lu changes, %lu timings late\n", d.target, d.msSum / d.frames, d.levelSum / d.frames / DYNRES_STEPS,
+           dynResScale(), d.changes, d.missed);
+}
+
+// --software: pieces are rasterized on the CPU, for machines where GL gives no
+// 4.1 context or only a slow one. The screen is cut into tiles the worker
+// pool fills in parallel, each from the quads binned to it in stacking order;
+// the picture and the mask atlas are sampled bilinearly from memory, a pixel's
+// four channels per SIMD op. A window gets the frame through one texture
+// blit; headless runs need no GL at all
+const int SW_TILE = 64;
+
+// an on-screen piece: covered pixels, rows counted from the top, and texel
+// coordinates as a + b * pixel centre
+struct SoftwareQuad {
+    int x0, y0, x1, y1;
+    float ua, ub, va, vb;
+    float mua, mub, mva, mvb;
+    // one over the mask's change per pixel, for a pixel-wide rim
+    float edge;
+    // mip level and the weight of the next one, constant over a quad
+    int level;
+    float blend;
+};
+
+struct SoftwareLevel {
+    std::vector<unsigned char> texels;
+    int w, h;
+};
+
+struct SoftwareRenderer {
+    std::vector<uint8_t> color;
+    int w, h, tilesX, tilesY;
+    std::vector<SoftwareLevel> levels;
+    std::vector<SoftwareQuad> quads;
+    std::vector<std::vector<int>> bins;
+    GLuint presentTex, presentFbo;
+    unsigned long frames, quadCount, binCount;
+    double rasterSeconds;
+};
+
+SoftwareRenderer sw = {};
+
+bool swLoadPicture(const char* path, int& w, int& h)
+{
+    int ch;
+    double t0 = now();
+    unsigned char* data = stbi_load(path, &w, &h, &ch, 4);
+    if (!data) {
+        fprintf(stderr, "Failed to load: %s (%s)\n", path, stbi_failure_reason());
+        return false;
+    }
+    // the same chain the GL path samples trilinearly
+    sw.levels.assign(1, {std::vector<unsigned char>(data, data + (size_t)w * h * 4), w, h});
+    stbi_image_free(data);
+    while (sw.levels.back().w > 1 || sw.levels.back().h > 1) {
+        const SoftwareLevel &l = sw.levels.back();
+        SoftwareLevel next = {{}, l.w > 1 ? l.w / 2 : 1, l.h > 1 ? l.h / 2 : 1};
+        next.texels.resize((size_t)next.w * next.h * 4);
+        downsample2x(l.texels.data(), l.w, l.h, next.texels.data());
+        sw.levels.push_back(std::move(next));
+    }
+    printf("texture: decoded and %zu levels built in %.1f ms, sampled from memory by the software renderer\n",
+           sw.levels.size(), (now() - t0) * 1000.0);
+    return true;
+}
+
+// the window's frame is a texture blitted to the default framebuffer
+void swResize(int w, int h)
+{
+    sw.w = w;
+    sw.h = h;
+    sw.color.assign((size_t)w * h * 4, 0);
+    sw.tilesX = (w + SW_TILE - 1) / SW_TILE;
+    sw.tilesY = (h + SW_TILE - 1) / SW_TILE;
+    sw.bins.assign((size_t)sw.tilesX * sw.tilesY, std::vector<int>());
+    if (headless) return;
+    if (!sw.presentTex) {
+        glGenTextures(1, &sw.presentTex);
+        glGenFramebuffers(1, &sw.presentFbo);
+    }
+    glBindTexture(GL_TEXTURE_2D, sw.presentTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, sw.presentFbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sw.presentTex, 0);
+}
+
+// stretched to the window when --dynamic-res drew it smaller
+void swPresent(int w, int h)
+{
+    glBindTexture(GL_TEXTURE_2D, sw.presentTex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, sw.w, sw.h, GL_RGBA, GL_UNSIGNED_BYTE, sw.color.data());
+    glsCountUpload(sw.color.size());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, sw.presentFbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    // rows were written from the top
+    glBlitFramebuffer(0, 0, sw.w, sw.h, 0, h, w, 0, GL_COLOR_BUFFER_BIT,
+                      sw.w == w && sw.h == h ? GL_NEAREST : GL_LINEAR);
+}
+
+// a texel's RGBA as four floats in 0..255
+#if defined(__SSE2__)
+typedef __m128 SwPixel;
+static inline SwPixel swTexel(const unsigned char* p)
+{
+    int bits;
+    memcpy(&bits, p, 4);
+    __m128i z = _mm_setzero_si128();
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), z), z));
+}
+static inline SwPixel swLerp(SwPixel a, SwPixel b, float t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+}
+// dst = src * a + dst * (1 - src alpha * a), as the GL path blends
+static inline void swBlend(unsigned char* dst, SwPixel src, float a)
+{
+    src = _mm_mul_ps(src, _mm_set1_ps(a));
+    float keep = 1.0f - _mm_cvtss_f32(_mm_shuffle_ps(src, src, _MM_SHUFFLE(3, 3, 3, 3))) / 255.0f;
+    __m128 out = _mm_add_ps(src, _mm_mul_ps(swTexel(dst), _mm_set1_ps(keep)));
+    __m128i i = _mm_cvtps_epi32(out);
+    i = _mm_packus_epi16(_mm_packs_epi32(i, i), i);
+    int bits = _mm_cvtsi128_si32(i);
+    memcpy(dst, &bits, 4);
+}
+#elif defined(__ARM_NEON)
+typedef float32x4_t SwPixel;
+static inline SwPixel swTexel(const unsigned char* p)
+{
+    uint32_t bits;
+    memcpy(&bits, p, 4);
+    uint16x8_t w = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(bits)));
+    return vcvtq_f32_u32(vmovl_u16(vget_low_u16(w)));
+}
+static inline SwPixel swLerp(SwPixel a, SwPixel b, float t)
+{
+    return vmlaq_n_f32(a, vsubq_f32(b, a), t);
+}
+static inline void swBlend(unsigned char* dst, SwPixel src, float a)
+{
+    src = vmulq_n_f32(src, a);
+    float keep = 1.0f - vgetq_lane_f32(src, 3) / 255.0f;
+    float32x4_t out = vmlaq_n_f32(src, swTexel(dst), keep);
+    uint32x4_t i = vcvtq_u32_f32(vaddq_f32(out, vdupq_n_f32(0.5f)));
+    uint8x8_t b = vqmovn_u16(vcombine_u16(vqmovn_u32(i), vqmovn_u32(i)));
+    vst1_lane_u32((uint32_t*)dst, vreinterpret_u32_u8(b), 0);
+}
+#else
+struct SwPixel {
+    float c[4];
+};
+static inline SwPixel swTexel(const unsigned char* p)
+{
+    return {{(float)p[0], (float)p[1], (float)p[2], (float)p[3]}};
+}
+static inline SwPixel swLerp(SwPixel a, SwPixel b, float t)
+{
+    for (int k = 0; k < 4; ++k) a.c[k] += (b.c[k] - a.c[k]) * t;
+    return a;
+}
+static inline void swBlend(unsigned char* dst, SwPixel src, float a)
+{
+    float keep = 1.0f - src.c[3] * a / 255.0f;
+    for (int k = 0; k < 4; ++k) dst[k] = (uint8_t)fminf(src.c[k] * a + dst[k] * keep + 0.5f, 255.0f);
+}
+#endif
+
+// u, v in level 0 texels; clamped to the edge like the GL textures
+static inline SwPixel swSampleLevel(const SoftwareLevel& l, float u, float v)
+{
+    int w = l.w, h = l.h;
+    u = fminf(fmaxf(u, 0.0f), (float)(w - 1));
+    v = fminf(fmaxf(v, 0.0f), (float)(h - 1));
+    int x = (int)u, y = (int)v;
+    int x1 = std::min(x + 1, w - 1), y1 = std::min(y + 1, h - 1);
+    const unsigned char* r0 = l.texels.data() + (size_t)y * w * 4;
+    const unsigned char* r1 = l.texels.data() + (size_t)y1 * w * 4;
+    float fx = u - x;
+    return swLerp(swLerp(swTexel(r0 + x * 4), swTexel(r0 + x1 * 4), fx),
+                  swLerp(swTexel(r1 + x * 4), swTexel(r1 + x1 * 4), fx), v - y);
+}
+
+static inline SwPixel swSample(const SoftwareQuad& q, float u, float v)
+{
+    // texel centres of level n sit at (u + 0.5) / 2^n - 0.5
+    float scale = 1.0f / (float)(1 << q.level);
+    const SoftwareLevel &l = sw.levels[q.level];
+    SwPixel c = swSampleLevel(l, (u + 0.5f) * scale - 0.5f, (v + 0.5f) * scale - 0.5f);
+    if (q.blend <= 0.0f) return c;
+    scale *= 0.5f;
+    const SoftwareLevel &n = sw.levels[q.level + 1];
+    return swLerp(c, swSampleLevel(n, (u + 0.5f) * scale - 0.5f, (v + 0.5f) * scale - 0.5f), q.blend);
+}
+
+static inline float swMask(float u, float v)
+{
+    const int size = MASK_GRID * MASK_SIZE;
+    u = fminf(fmaxf(u, 0.0f), (float)(size - 1));
+    v = fminf(fmaxf(v, 0.0f), (float)(size - 1));
+    int x = (int)u, y = (int)v;
+    int x1 = std::min(x + 1, size - 1), y1 = std::min(y + 1, size - 1);
+    const uint8_t* m = maskTexels.data();
+    float fx = u - x, fy = v - y;
+    float a = m[y * size + x] + (m[y * size + x1] - m[y * size + x]) * fx;
+    float b = m[y1 * size + x] + (m[y1 * size + x1] - m[y1 * size + x]) * fx;
+    return (a + (b - a) * fy) / 255.0f;
+}
+
+void swRasterTile(int tile)
+{
+    int x0 = tile % sw.tilesX * SW_TILE, y0 = tile / sw.tilesX * SW_TILE;
+    int x1 = std::min(x0 + SW_TILE, sw.w), y1 = std::min(y0 + SW_TILE, sw.h);
+    for (int y = y0; y < y1; ++y) {
+        unsigned char* row = &sw.color[((size_t)y * sw.w + x0) * 4];
+        for (int x = x0; x < x1; ++x, row += 4) {
+            row[0] = row[1] = row[2] = 0;
+            row[3] = 255;
+        }
+    }
+    for (int index : sw.bins[tile]) {
+        const SoftwareQuad &q = sw.quads[index];
+        int xs = std::max(x0, q.x0), xe = std::min(x1, q.x1);
+        int ys = std::max(y0, q.y0), ye = std::min(y1, q.y1);
+        for (int y = ys; y < ye; ++y) {
+            float v = q.va + q.vb * (y + 0.5f), mv = q.mva + q.mvb * (y + 0.5f);
+            unsigned char* dst = &sw.color[((size_t)y * sw.w + xs) * 4];
+            for (int x = xs; x < xe; ++x, dst += 4) {
+                float cx = x + 0.5f;
+                float a = fminf(fmaxf((swMask(q.mua + q.mub * cx, mv) - 0.5f) * q.edge + 0.5f, 0.0f), 1.0f);
+                if (a <= 0.0f) continue;
+                swBlend(dst, swSample(q, q.ua + q.ub * cx, v), a);
+            }
+        }
+    }
+}
+
+// the same picture as the GL path: snapped pieces, then the loose ones bottom
+// up, dragged piece included (there is nothing to latch late)
+void swRenderBoard(const BoardView& v)
+{
+    view = v;
+    dragSampleTime = v.inputTime;
+    if (v.width < 1 || v.height < 1) return;
+    double start = now();
+    int w = v.width, h = v.height;
+    dynResSize(w, h);
+    if (w != sw.w || h != sw.h) swResize(w, h);
+
+    for (auto &bin : sw.bins) bin.clear();
+    sw.quads.clear();
+    float wx0, wy0, wx1, wy1;
+    visibleRect(wx0, wy0, wx1, wy1);
+    const Camera &c = v.camera;
+    float sx = c.zoom * 0.5f * w, sy = c.zoom * 0.5f * h;
+    const float span = 1.0f + 2.0f * PIECE_PAD;
+    auto add = [&](const PuzzlePiece& p) {
+        if (!pieceVisible(p, wx0, wy0, wx1, wy1)) {
+            piecesCulled++;
+            return;
+        }
+        float left = (p.x - p.extent - c.x) * sx + w * 0.5f;
+        float right = (p.x + p.extent - c.x) * sx + w * 0.5f;
+        float top = h * 0.5f - (p.y + p.extent - c.y) * sy;
+        float bottom = h * 0.5f - (p.y - p.extent - c.y) * sy;
+        SoftwareQuad q;
+        // pixels whose centres are inside
+        q.x0 = std::max(0, (int)ceilf(left - 0.5f));
+        q.x1 = std::min(w, (int)ceilf(right - 0.5f));
+        q.y0 = std::max(0, (int)ceilf(top - 0.5f));
+        q.y1 = std::min(h, (int)ceilf(bottom - 0.5f));
+        if (q.x0 >= q.x1 || q.y0 >= q.y1) return;
+        float qw = right - left, qh = bottom - top;
+        const SoftwareLevel &base = sw.levels[0];
+        q.ub = (p.u1 - p.u0) * base.w / qw;
+        q.ua = p.u0 * base.w - 0.5f - left * q.ub;
+        q.vb = (p.v0 - p.v1) * base.h / qh;
+        q.va = p.v1 * base.h - 0.5f - top * q.vb;
+        float lod = fmaxf(log2f(fmaxf(fabsf(q.ub), fabsf(q.vb))), 0.0f);
+        q.level = std::min((int)lod, (int)sw.levels.size() - 1);
+        q.blend = q.level + 1 < (int)sw.levels.size() ? lod - q.level : 0.0f;
+        float mu0 = (float)(p.shape % MASK_GRID) * MASK_SIZE, mv1 = (float)(p.shape / MASK_GRID + 1) * MASK_SIZE;
+        q.mub = MASK_SIZE / qw;
+        q.mua = mu0 - 0.5f - left * q.mub;
+        q.mvb = -MASK_SIZE / qh;
+        q.mva = mv1 - 0.5f - top * q.mvb;
+        q.edge = 2.0f * MASK_SPREAD * fminf(qw, qh) / span;
+        int index = (int)sw.quads.size();
+        sw.quads.push_back(q);
+        for (int ty = q.y0 / SW_TILE; ty <= (q.y1 - 1) / SW_TILE; ++ty)
+            for (int tx = q.x0 / SW_TILE; tx <= (q.x1 - 1) / SW_TILE; ++tx) {
+                sw.bins[(size_t)ty * sw.tilesX + tx].push_back(index);
+                sw.binCount++;
+            }
+    };
+    forEachPiece(*v.pieces, true, false, add);
+    forEachPiece(*v.pieces, false, false, add);
+    sw.quadCount += sw.quads.size();
+
+    double t0 = now();
+    parallelFor(sw.tilesX * sw.tilesY, [](int tile) { swRasterTile(tile); });
+    sw.rasterSeconds += now() - t0;
+    sw.frames++;
+    if (!headless) swPresent(v.width, v.height);
+    if (dynres.target > 0.0f) dynResAdjust((float)((now() - start) * 1000.0));
+    glsEndFrame();
+}
+
+void swShutdown()
+{
+    if (sw.presentTex) {
+        glDeleteTextures(1, &sw.presentTex);
+        glDeleteFramebuffers(1, &sw.presentFbo);
+    }
+    sw.levels.clear();
+}
+
+void printSoftwareStats()
+{
+    if (!softwareBackend || sw.frames == 0) return;
+    printf("software: %zu threads, %d px tiles, %.1f quads and %.1f tile bins per frame, %.2f ms rasterizing\n",
+           pool.threads.size() + 1, SW_TILE, (double)sw.quadCount / sw.frames, (double)sw.binCount / sw.frames,
+           sw.rasterSeconds * 1000.0 / sw.frames);
+}
+
+// how many frames ago the back buffer was drawn, 0 when nothing says
+// (EGL_EXT_buffer_age / GLX_EXT_buffer_age, neither of them on macOS)
+int bufferAge()
+{
+    // screenFbo is never swapped, so it always holds the last frame
+    if (headless) return 1;
+#ifdef JIGSAW_HEADLESS
+    EGLDisplay dpy = eglGetCurrentDisplay();
+    if (dpy != EGL_NO_DISPLAY) {
+        static EGLDisplay checked = EGL_NO_DISPLAY;
+        static bool hasAge = false;
+        if (dpy != checked) {
+            const char* ext = eglQueryString(dpy, EGL_EXTENSIONS);
+            hasAge = ext && strstr(ext, "EGL_EXT_buffer_age");
+            checked = dpy;
+        }
+        EGLint age = 0;
+        if (!hasAge || !eglQuerySurface(dpy, eglGetCurrentSurface(EGL_DRAW), EGL_BUFFER_AGE_EXT, &age)) return 0;
+        return age;
+    }
+    // GLX can't be included next to glad, so its entry points are looked up
+    typedef void* (*GetCurrentDisplay)();
+    typedef unsigned long (*GetCurrentDrawable)();
+    typedef const char* (*QueryExtensionsString)(void*, int);
+    typedef void (*QueryDrawable)(void*, unsigned long, int, unsigned int*);
+    const int GLX_BACK_BUFFER_AGE_EXT = 0x20F4;
+    static GetCurrentDisplay getDisplay = (GetCurrentDisplay)dlsym(RTLD_DEFAULT, "glXGetCurrentDisplay");
+    static GetCurrentDrawable getDrawable = (GetCurrentDrawable)dlsym(RTLD_DEFAULT, "glXGetCurrentDrawable");
+    static QueryExtensionsString queryExtensions =
+        (QueryExtensionsString)dlsym(RTLD_DEFAULT, "glXQueryExtensionsString");
+    static QueryDrawable queryDrawable = (QueryDrawable)dlsym(RTLD_DEFAULT, "glXQueryDrawable");
+    if (!getDisplay || !getDrawable || !queryExtensions || !queryDrawable) return 0;
+    void* xdpy = getDisplay();
+    unsigned long drawable = getDrawable();
+    if (!xdpy || !drawable) return 0;
+    static void* checkedX = NULL;
+    static bool hasAgeX = false;
+    if (xdpy != checkedX) {
+        const char* ext = queryExtensions(xdpy, 0);
+        hasAgeX = ext && strstr(ext, "GLX_EXT_buffer_age");
+        checkedX = xdpy;
+    }
+    if (!hasAgeX) return 0;
+    unsigned int age = 0;
+    queryDrawable(xdpy, drawable, GLX_BACK_BUFFER_AGE_EXT, &age);
+    return (int)age;
+#else
+    return 0;
+#endif
+}
+
+// picks what this frame redraws into damage.box; false means the whole screen
+bool trackDamage()
+{
+    Damage &d = damage;
+    const std::vector<PuzzlePiece> &src = *view.pieces;
+    bool full = d.marks.size() != src.size() || view.generation != d.generation ||
+                memcmp(&view.camera, &d.camera, sizeof(Camera)) != 0 || view.width != d.width ||
+                view.height != d.height || upload.pixels || vt.loads != d.vtLoads || profiler.overlay ||
+                (lowLatency && !headless && view.dragged != -1);
+    d.marks.resize(src.size());
+    d.camera = view.camera;
+    d.width = view.width;
+    d.height = view.height;
+    d.generation = view.generation;
+    d.vtLoads = vt.loads;
+
+    // world box around where changed pieces were and are
+    float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+    for (size_t i = 0; i < src.size(); ++i) {
+        const PuzzlePiece &p = src[i];
+        PieceMark &m = d.marks[i];
+        if (m.x == p.x && m.y == p.y && m.depth == p.depth && m.snapped == p.snapped) continue;
+        x0 = fminf(x0, fminf(m.x, p.x) - p.extent);
+        y0 = fminf(y0, fminf(m.y, p.y) - p.extent);
+        x1 = fmaxf(x1, fmaxf(m.x, p.x) + p.extent);
+        y1 = fmaxf(y1, fmaxf(m.y, p.y) + p.extent);
+        m = {p.x, p.y, p.depth, p.snapped};
+    }
+
+    int box[4] = {0, 0, 0, 0};
+    if (full) {
+        box[2] = view.width;
+        box[3] = view.height;
+    } else if (x0 < x1) {
+        const Camera &c = view.camera;
+        float sx = c.zoom * 0.5f * view.width, sy = c.zoom * 0.5f * view.height;
+        box[0] = std::max(0, (int)floorf((x0 - c.x) * sx + view.width * 0.5f - DAMAGE_PAD));
+        box[1] = std::max(0, (int)floorf((y0 - c.y) * sy + view.height * 0.5f - DAMAGE_PAD));
+        box[2] = std::min(view.width, (int)ceilf((x1 - c.x) * sx + view.width * 0.5f + DAMAGE_PAD));
+        box[3] = std::min(view.height, (int)ceilf((y1 - c.y) * sy + view.height * 0.5f + DAMAGE_PAD));
+        // the minimap shows the same pieces
+        if (minimapEnabled && minimap.fbo) {
+            box[0] = std::min(box[0], view.width - (int)MINIMAP_MARGIN - minimap.w);
+            box[1] = std::min(box[1], (int)MINIMAP_MARGIN);
+            box[2] = std::max(box[2], view.width - (int)MINIMAP_MARGIN);
+            box[3] = std::max(box[3], (int)MINIMAP_MARGIN + minimap.h);
+        }
+    }
+    memmove(d.boxes[1], d.boxes[0], sizeof(d.boxes) - sizeof(d.boxes[0]));
+    memcpy(d.boxes[0], box, sizeof(box));
+    d.history = std::min(d.history + 1, DAMAGE_HISTORY);
+    d.frames++;
+
+    int age = bufferAge();
+    if (age == 0) d.unknownAge++;
+    if (full || age == 0 || age > d.history) {
+        d.area += 1.0;
+        return false;
+    }
+    d.box[0] = d.box[1] = INT32_MAX;
+    d.box[2] = d.box[3] = 0;
+    for (int i = 0; i < age; ++i) {
+        const int* b = d.boxes[i];
+        if (b[0] >= b[2] || b[1] >= b[3]) continue;
+        d.box[0] = std::min(d.box[0], b[0]);
+        d.box[1] = std::min(d.box[1], b[1]);
+        d.box[2] = std::max(d.box[2], b[2]);
+        d.box[3] = std::max(d.box[3], b[3]);
+    }
+    if (d.box[0] >= d.box[2]) d.box[0] = d.box[1] = d.box[2] = d.box[3] = 0;
+    d.partial++;
+    d.area += (double)(d.box[2] - d.box[0]) * (d.box[3] - d.box[1]) / ((double)view.width * view.height);
+    return true;
+}
+
+void printDamageStats()
+{
+    if (!damageTracking || damage.frames == 0) return;
+    printf("damage: %lu of %lu frames redrawn in part, %.1f%% of the screen drawn on average, "
+           "buffer age unknown in %lu\n", damage.partial, damage.frames, damage.area * 100.0 / damage.frames,
+           damage.unknownAge);
+}
+
+void renderBoard(const BoardView& v)
+{
+    if (softwareBackend) {
+        swRenderBoard(v);
+        return;
+    }
+    view = v;
+    dragSampleTime = v.inputTime;
+    glsUseProgram(texShader);
+    glsBindVertexArray(vao);
+    glsViewport(0, 0, v.width, v.height);
+    dynResFrameBegin();
+
+    streamBeginFrame();
+    {
+        ProfileScope scope(PROF_UPLOAD);
+        vtUpdate();
+    }
+
+    // its own render target; not part of clearing the frame
+    updateMinimap();
+    profGpuBegin(PROF_GPU_CLEAR);
+    bool scaled = dynResBegin();
+    // the board layer follows the size the board is drawn at
+    updateBoardLayer();
+    if (scaled) {
+        glsBindFramebuffer(dynres.fbo);
+        glsViewport(0, 0, view.width, view.height);
+    }
+    bool partial = damageTracking && trackDamage();
+    const int* box = damage.box;
+    bool unchanged = partial && box[0] >= box[2];
+    if (partial) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(box[0], box[1], box[2] - box[0], box[3] - box[1]);
+    }
+    if (!unchanged) {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    profGpuEnd();
+
+    profGpuBegin(PROF_GPU_PIECES);
+    if (!unchanged) {
+        setCameraXform();
+        bindTiles();
+        drawStack();
+        if (scaled) dynResUpscale(v);
+        drawMinimap();
+    }
+    profGpuEnd();
+    if (partial) glDisable(GL_SCISSOR_TEST);
+
+    if (profiler.overlay) drawProfileOverlay();
+    dynResFrameEnd();
+    streamEndFrame();
+    glsEndFrame();
+}
+
+// signed distance (in cells, negative inside) to the outline of `shape` at
+// (x, y) around the cell centre. A tab is a circle just past the edge and a
+// blank the same circle seen from the neighbour, so the two fit exactly
+float shapeDistance(int shape, float x, float y)
+{
+    float qx = fabsf(x) - 0.5f, qy = fabsf(y) - 0.5f;
+    float d = hypotf(fmaxf(qx, 0.0f), fmaxf(qy, 0.0f)) + fminf(fmaxf(qx, qy), 0.0f);
+    // top, right, bottom, left, as in the shape code
+    const float nx[4] = {0.0f, 1.0f, 0.0f, -1.0f}, ny[4] = {1.0f, 0.0f, -1.0f, 0.0f};
+    for (int e = 0; e < 4; ++e, shape /= 3) {
+        int kind = shape % 3;
+        if (kind == EDGE_FLAT) continue;
+        float c = kind == EDGE_TAB ? 0.5f + TAB_OFFSET : 0.5f - TAB_OFFSET;
+        float dc = hypotf(x - nx[e] * c, y - ny[e] * c) - TAB_RADIUS;
+        d = kind == EDGE_TAB ? fminf(d, dc) : fmaxf(d, -dc);
+    }
+    return d;
+}
+
+void buildMaskAtlas()
+{
+    double t0 = now();
+    int size = MASK_GRID * MASK_SIZE;
+    std::vector<uint8_t> texels((size_t)size * size);
+    float span = 1.0f + 2.0f * PIECE_PAD;
+    parallelFor(MASK_SHAPES, [&](int shape) {
+        int ox = shape % MASK_GRID * MASK_SIZE, oy = shape / MASK_GRID * MASK_SIZE;
+        for (int j = 0; j < MASK_SIZE; ++j) {
+            for (int i = 0; i < MASK_SIZE; ++i) {
+                float x = ((i + 0.5f) / MASK_SIZE - 0.5f) * span;
+                float y = ((j + 0.5f) / MASK_SIZE - 0.5f) * span;
+                float v = 0.5f - shapeDistance(shape, x, y) / (2.0f * MASK_SPREAD);
+                texels[(size_t)(oy + j) * size + ox + i] = (uint8_t)(fminf(fmaxf(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    });
+
+    if (softwareBackend) {
+        // sampled straight from memory
+        maskTexels.swap(texels);
+    } else {
+        glGenTextures(1, &maskAtlas);
+        glsActiveTexture(GL_TEXTURE0 + MASK_UNIT);
+        glsBindTexture(GL_TEXTURE_2D, maskAtlas);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, size, size, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glsCountUpload(texels.size());
+    }
+    printf("masks: %d shapes in a %dx%d distance field atlas, built in %.1f ms\n",
+           MASK_SHAPES, size, size, (now() - t0) * 1000.0);
+}
+
+void setupRenderer(bool streamOrphan)
+{
+    if (!meshPieces) buildMaskAtlas();
 
-struct PuzzlePiece {
-    float x, y;
-    float size;
-    float u0, v0;
-    float u1, v1;
-    float tx, ty;
-    bool snapped;
-};
+    float quad[16] = {
+        -0.5f, -0.5f, 0.0f, 0.0f,
+		0.5f, -0.5f, 1.0f, 0.0f,
+		0.5f,  0.5f, 1.0f, 1.0f,
+        -0.5f,  0.5f, 0.0f, 1.0f
+    };
+    unsigned int idx[] = {0,1,2, 2,3,0};
 
-std::vector<PuzzlePiece> pieces;
-GLuint tex = 0;
-GLuint vao = 0, vbo = 0, ebo = 0;
-GLuint texShader = 0;
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
 
-bool prevMouseDown = false;
-bool mouseDown = false;
-int dragged = -1;
-float grabOffsetX = 0.0f;
-float grabOffsetY = 0.0f;
+    glsBindVertexArray(vao);
+    glsBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glsBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glsBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(idx), idx, GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0,2,GL_FLOAT,GL_FALSE,4*sizeof(float),(void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,4*sizeof(float),(void*)(2*sizeof(float)));
+
+    // instance attributes are pointed into the stream buffer each frame
+    streamInit(streamOrphan);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2,1);
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3,1);
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4,1);
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(5,1);
+    glEnableVertexAttribArray(7);
+    glVertexAttribDivisor(7,1);
+
+    const char* vs =
+        "#version 410 core\n"
+        "layout(location=0) in vec2 pos;\n"
+        "layout(location=1) in vec2 uv;\n"
+        "layout(location=2) in vec4 rect;\n"
+        "layout(location=3) in vec4 uvRect;\n"
+        "layout(location=4) in float unit;\n"
+        "layout(location=5) in vec4 maskRect;\n"
+        "layout(location=6) in float piece;\n"
+        "layout(location=7) in float depth;\n"
+        "uniform vec4 xform;\n"
+        "uniform vec4 offset;\n"
+        "uniform bool meshes;\n"
+        "uniform int meshBase;\n"
+        "uniform samplerBuffer meshTable;\n"
+        "out vec2 v_uv;\n"
+        "out vec2 v_mask;\n"
+        "flat out int v_unit;\n"
+        "void main(){\n"
+        "    vec2 c = uv;\n"
+        "    vec4 r = rect, t = uvRect;\n"
+        "    float u = unit, d = depth;\n"
+        "    if (meshes) {\n"
+        "        int i = meshBase + 3 * int(piece);\n"
+        "        r = texelFetch(meshTable, i);\n"
+        "        t = texelFetch(meshTable, i + 1);\n"
+        "        vec4 e = texelFetch(meshTable, i + 2);\n"
+        "        u = e.x;\n"
+        "        d = e.y;\n"
+        "        c = pos + 0.5;\n"
+        "    }\n"
+        "    v_uv = mix(t.xy, t.zw, c);\n"
+        "    v_mask = mix(maskRect.xy, maskRect.zw, c);\n"
+        "    v_unit = int(u);\n"
+        "    vec2 p = mix(r.xy, r.zw, c) + offset.xy;\n"
+        "    gl_Position = vec4(p * xform.xy + xform.zw, 1.0 - 2.0 * d, 1);\n"
+        "}\n";
+
+    // GLSL 4.10 only indexes sampler arrays with constants, hence the switch
+    // over the units in use; gradients are taken outside it since the unit
+    // varies per instance
+    std::string fs =
+        "#version 410 core\n"
+        "in vec2 v_uv;\n"
+        "in vec2 v_mask;\n"
+        "flat in int v_unit;\n"
+        "out vec4 frag;\n" +
+        // at most the 16 samplers GL 4.1 guarantees a fragment shader
+        (pictureArray ? std::string("uniform sampler2DArray pictures;\n")
+                      : "uniform sampler2D tiles[" + std::to_string(TILE_UNITS) + "];\n") +
+        "uniform sampler2D mask;\n"
+        "uniform sampler2D layer;\n"
+        "uniform vec4 tileRects[" + std::to_string(TILE_UNITS) + "];\n"
+        "uniform int coverage;\n" +
+        (vt.active ? vtSampleSource : "") +
+        "void main(){\n"
+        "    vec2 uv = v_uv, dx = dFdx(v_uv), dy = dFdy(v_uv);\n"
+        "    int unit = v_unit;\n";
+    // coverage from the distance field, a pixel wide whatever the zoom, and
+    // tested before the picture is sampled; meshes carry their outline in
+    // the geometry
+    if (!meshPieces)
+        fs += "    float m = texture(mask, v_mask).r;\n"
+              "    float a = clamp((m - 0.5) / max(fwidth(m), 1e-4) + 0.5, 0.0, 1.0);\n"
+              "    if (a <= 0.0 || (coverage == " + std::to_string(COVER_OPAQUE) + " && a < 1.0) ||\n"
+              "        (coverage == " + std::to_string(COVER_RIM) + " && a >= 1.0)) discard;\n";
+    // a mesh across a tile seam carries picture UVs; the tile is found here
+    bool straddle = meshPieces && !vt.active && tiles.size() > 1;
+    if (straddle)
+        fs += "    if (unit < 0) {\n"
+              "        for (int i = 0; i < " + std::to_string(tiles.size()) + "; ++i) {\n"
+              "            vec4 r = tileRects[i];\n"
+              "            if (all(greaterThanEqual(uv, r.xy)) && all(lessThanEqual(uv, r.zw))) {\n"
+              "                vec2 s = 1.0 / (r.zw - r.xy);\n"
+              "                uv = (uv - r.xy) * s;\n"
+              "                dx *= s;\n"
+              "                dy *= s;\n"
+              "                unit = i;\n"
+              "                break;\n"
+              "            }\n"
+              "        }\n"
+              "    }\n";
+    fs += "    switch (unit) {\n";
+    for (int i = 0; i < GLS_TEXTURE_UNITS; ++i) {
+        std::string n = std::to_string(i);
+        if (vt.active && i == VT_CACHE_UNIT)
+            fs += "    case " + n + ": frag = sampleVirtual(uv, dx, dy); break;\n";
+        else if (i == LAYER_UNIT)
+            fs += "    case " + n + ": frag = textureGrad(layer, uv, dx, dy); break;\n";
+        else if (i < (int)tiles.size())
+            fs += "    case " + n + ": frag = textureGrad(tiles[" + n + "], uv, dx, dy); break;\n";
+    }
+    if (pictureArray)
+        fs += "    default: frag = textureGrad(pictures, vec3(uv, float(unit - " + std::to_string(PICTURE_LAYER_BASE) +
+              ")), dx, dy); break;\n";
+    else
+        fs += "    default: discard;\n";
+    fs += "    }\n";
+    if (!meshPieces) fs += "    frag *= a;\n";
+    fs += "}\n";
+
+    // the profiler overlay draws flat rects through the same vertex stage
+    const char* overlayFs =
+        "#version 410 core\n"
+        "uniform vec4 color;\n"
+        "out vec4 frag;\n"
+        "void main(){ frag = color; }\n";
 
-static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+    ProgramBuild builds[2] = {};
+    builds[0].vs = vs;
+    builds[0].fs = fs.c_str();
+    builds[1].vs = vs;
+    builds[1].fs = overlayFs;
+    buildPrograms(builds, 2);
+    texShader = builds[0].program;
+    overlayShader = builds[1].program;
+    texShaderXform = uniformLocation(texShader, "xform");
+    texShaderOffset = uniformLocation(texShader, "offset");
+    texShaderMeshes = uniformLocation(texShader, "meshes");
+    texShaderMeshBase = uniformLocation(texShader, "meshBase");
+    texShaderCoverage = uniformLocation(texShader, "coverage");
+    overlayXform = uniformLocation(overlayShader, "xform");
+    overlayColor = uniformLocation(overlayShader, "color");
+
+    GLint units[TILE_UNITS];
+    for (int i = 0; i < TILE_UNITS; ++i) units[i] = i;
+    glsUseProgram(overlayShader);
+    glUniform1i(uniformLocation(overlayShader, "meshTable"), MESH_TABLE_UNIT);
+    glsUseProgram(texShader);
+    glUniform1iv(uniformLocation(texShader, "tiles[0]"), TILE_UNITS, units);
+    glUniform1i(uniformLocation(texShader, "mask"), MASK_UNIT);
+    glUniform1i(uniformLocation(texShader, "layer"), LAYER_UNIT);
+    // its samplerBuffer must not share a unit with the tiles
+    glUniform1i(uniformLocation(texShader, "meshTable"), MESH_TABLE_UNIT);
+    glUniform1i(uniformLocation(texShader, "pictures"), PICTURE_ARRAY_UNIT);
+    if (meshPieces) {
+        glGenTextures(1, &meshTable);
+        std::vector<float> rects;
+        for (auto &t : tiles) rects.insert(rects.end(), {t.u0, t.v0, t.u1, t.v1});
+        if (!rects.empty())
+            glUniform4fv(uniformLocation(texShader, "tileRects[0]"), (GLsizei)tiles.size(), rects.data());
+    }
+    if (vt.active) {
+        glsUniform4f(uniformLocation(texShader, "vtImage"), (float)vt.w, (float)vt.h,
+                     (float)(vt.levels.size() - 1), (float)VT_CONTENT);
+        glsUniform4f(uniformLocation(texShader, "vtCache"), (float)(VT_CACHE_PAGES * VT_PAGE),
+                     (float)VT_PAGE, (float)VT_BORDER, 0.0f);
+    }
+}
+
+void shutdownRenderer()
 {
-    WINDOW_W = width;
-    WINDOW_H = height;
-    glViewport(0, 0, width, height);
+    deleteTiles();
+    if (maskAtlas) glsDeleteTexture(maskAtlas);
+    if (meshVao) {
+        glsDeleteBuffer(meshVbo);
+        glsDeleteBuffer(meshEbo);
+        glDeleteVertexArrays(1, &meshVao);
+        meshVao = 0;
+        meshUploaded = 0;
+    }
+    if (meshTable) glsDeleteTexture(meshTable);
+    if (pictureArray) glsDeleteTexture(pictureArray);
+    if (boardFbo) {
+        glDeleteFramebuffers(1, &boardFbo);
+        glsDeleteTexture(boardTex);
+    }
+    if (minimap.fbo) {
+        glDeleteFramebuffers(1, &minimap.fbo);
+        glsDeleteTexture(minimap.texture);
+    }
+    if (dynres.fbo) {
+        glDeleteFramebuffers(1, &dynres.fbo);
+        glDeleteRenderbuffers(1, &dynres.color);
+        glDeleteRenderbuffers(1, &dynres.depth);
+    }
+    if (dynres.queries[0][0]) glDeleteQueries(4, &dynres.queries[0][0]);
+    glDeleteProgram(texShader);
+    glDeleteProgram(overlayShader);
+    if (profiler.queries[0][0]) glDeleteQueries(2 * PROF_GPU_SECTIONS, &profiler.queries[0][0]);
+    glsDeleteBuffer(vbo);
+    glsDeleteBuffer(ebo);
+    streamDropFences();
+    glsDeleteBuffer(stream.buffer);
+    glDeleteVertexArrays(1, &vao);
 }
 
-static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+// B key: time CPU-side frame cost while the grid grows from 9 to 10,000 pieces
+void runScalingBenchmark(GLFWwindow* window)
 {
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    const int grids[] = {3, 10, 32, 64, 100};
+    tweenFinishAll();
+    std::vector<PuzzlePiece> saved = pieces;
+    PieceMeshes savedMeshes = meshes;
+    dragged = -1;
+    // every frame is timed whole
+    bool tracking = damageTracking;
+    damageTracking = false;
+
+    glfwSwapInterval(0);
+    printf("bench: %6s %8s %14s %8s %8s %6s %10s\n",
+           "grid", "pieces", "cpu ms/frame", "issued", "elided", "draws", "KB upload");
+    for (int g : grids) {
+        // the whole board is replaced, so its keys can start over
+        depthCounter = 0;
+        pieces = generatePieces(g);
+        invalidateBoardLayer();
+        double cpu = 0.0;
+        for (int f = 0; f < BENCH_FRAMES; ++f) {
+            double t0 = now();
+            renderBoard(liveView());
+            cpu += now() - t0;
+            glfwSwapBuffers(window);
+        }
+        printf("bench: %6d %8zu %14.3f %8lu %8lu %6lu %10.1f\n", g, pieces.size(), cpu * 1000.0 / BENCH_FRAMES,
+               glStatsFrame.issued, glStatsFrame.elided, glStatsFrame.draws, glStatsFrame.uploadBytes / 1024.0);
+    }
+    printStreamStats();
+    applySwapInterval();
+    damageTracking = tracking;
+    pieces = saved;
+    meshes = savedMeshes;
+    boardGeneration++;
+    // the counter restarted below the saved keys
+    renumberDepths();
+    invalidateBoardLayer();
 }
 
-GLuint compile(GLenum type, const char* src)
+#ifdef JIGSAW_HEADLESS
+EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+EGLContext eglContext = EGL_NO_CONTEXT;
+EGLSurface eglSurface = EGL_NO_SURFACE;
+
+// Mesa's surfaceless platform needs no display server; llvmpipe is enough
+bool createHeadlessContext()
 {
-    GLuint s = glCreateShader(type);
-    glShaderSource(s, 1, &src, NULL);
-    glCompileShader(s);
-    GLint ok;
-    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
-    if (!ok) {
-        char log[1024];
-        glGetShaderInfoLog(s, 1024, NULL, log);
-        fprintf(stderr, "shader error: %s\n", log);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (eglDisplay == EGL_NO_DISPLAY)
+        eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, NULL, NULL)) {
+        fprintf(stderr, "headless: no EGL display\n");
+        return false;
     }
-    return s;
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint count = 0;
+    if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &count) || count == 0 ||
+        !eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "headless: no desktop GL config\n");
+        return false;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 1,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (eglContext == EGL_NO_CONTEXT) {
+        fprintf(stderr, "headless: could not create a GL 4.1 core context\n");
+        return false;
+    }
+
+    // everything is drawn into screenFbo, so a 1x1 pbuffer does when the
+    // driver lacks EGL_KHR_surfaceless_context
+    if (!eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+        const EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttribs);
+        if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)) {
+            fprintf(stderr, "headless: eglMakeCurrent failed\n");
+            return false;
+        }
+    }
+    return true;
 }
 
-GLuint makeProgram(const char* vs, const char* fs)
+void destroyHeadlessContext()
 {
-    GLuint v = compile(GL_VERTEX_SHADER, vs);
-    GLuint f = compile(GL_FRAGMENT_SHADER, fs);
-    GLuint p = glCreateProgram();
-    glAttachShader(p, v);
-    glAttachShader(p, f);
-    glLinkProgram(p);
-    GLint ok;
-    glGetProgramiv(p, GL_LINK_STATUS, &ok);
-    if (!ok) {
-        char log[1024];
-        glGetProgramInfoLog(p, 1024, NULL, log);
-        fprintf(stderr, "program link error: %s\n", log);
+    if (eglDisplay == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (eglSurface != EGL_NO_SURFACE) eglDestroySurface(eglDisplay, eglSurface);
+    if (eglContext != EGL_NO_CONTEXT) eglDestroyContext(eglDisplay, eglContext);
+    eglTerminate(eglDisplay);
+}
+#else
+bool createHeadlessContext()
+{
+    fprintf(stderr, "headless: built without EGL (define JIGSAW_HEADLESS)\n");
+    return false;
+}
+
+void destroyHeadlessContext() {}
+#endif
+
+bool createScreenTarget()
+{
+    glGenFramebuffers(1, &screenFbo);
+    glGenRenderbuffers(1, &screenColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, screenColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WINDOW_W, WINDOW_H);
+    glsBindFramebuffer(screenFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, screenColor);
+    glGenRenderbuffers(1, &screenDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, screenDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, WINDOW_W, WINDOW_H);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, screenDepth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "headless: offscreen framebuffer incomplete\n");
+        return false;
     }
-    glDeleteShader(v);
-    glDeleteShader(f);
-    return p;
+    glsViewport(0, 0, WINDOW_W, WINDOW_H);
+    return true;
 }
 
-GLuint loadTexture(const char* path, int& w, int& h)
+// uncompressed PNG (stored deflate blocks): big, but needs no zlib
+uint32_t pngCrc(uint32_t crc, const uint8_t* p, size_t n)
 {
-    int ch;
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
 
-    unsigned char* data = stbi_load(path, &w, &h, &ch, 4);
-    if (!data) {
-        fprintf(stderr, "Failed to load: %s (%s)\n", path, stbi_failure_reason());
-        return 0;
+void pngChunk(FILE* fp, const char* type, const std::vector<uint8_t>& data)
+{
+    uint8_t len[4] = {(uint8_t)(data.size() >> 24), (uint8_t)(data.size() >> 16),
+                      (uint8_t)(data.size() >> 8), (uint8_t)data.size()};
+    fwrite(len, 1, 4, fp);
+    fwrite(type, 1, 4, fp);
+    if (!data.empty()) fwrite(data.data(), 1, data.size(), fp);
+    uint32_t crc = pngCrc(pngCrc(0, (const uint8_t*)type, 4), data.data(), data.size());
+    uint8_t c[4] = {(uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc};
+    fwrite(c, 1, 4, fp);
+}
+
+bool writePNG(const char* path, const uint8_t* rgba, int w, int h)
+{
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "headless: cannot write %s\n", path);
+        return false;
     }
 
-    GLuint t;
-    glGenTextures(1, &t);
-    glBindTexture(GL_TEXTURE_2D, t);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    stbi_image_free(data);
-    return t;
+    // rows get a 'none' filter byte each
+    std::vector<uint8_t> raw;
+    raw.reserve((size_t)(w * 4 + 1) * h);
+    for (int y = 0; y < h; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgba + (size_t)y * w * 4, rgba + (size_t)(y + 1) * w * 4);
+    }
+
+    std::vector<uint8_t> z = {0x78, 0x01};
+    for (size_t pos = 0; pos < raw.size();) {
+        size_t n = std::min<size_t>(raw.size() - pos, 65535);
+        z.push_back(pos + n == raw.size());
+        z.push_back((uint8_t)n);
+        z.push_back((uint8_t)(n >> 8));
+        z.push_back((uint8_t)~n);
+        z.push_back((uint8_t)(~n >> 8));
+        z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + n);
+        pos += n;
+    }
+    uint32_t a = 1, b = 0;
+    for (uint8_t v : raw) {
+        a = (a + v) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    z.push_back((uint8_t)(adler >> 24));
+    z.push_back((uint8_t)(adler >> 16));
+    z.push_back((uint8_t)(adler >> 8));
+    z.push_back((uint8_t)adler);
+
+    std::vector<uint8_t> ihdr = {
+        (uint8_t)(w >> 24), (uint8_t)(w >> 16), (uint8_t)(w >> 8), (uint8_t)w,
+        (uint8_t)(h >> 24), (uint8_t)(h >> 16), (uint8_t)(h >> 8), (uint8_t)h,
+        8, 6, 0, 0, 0
+    };
+    const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(sig, 1, 8, fp);
+    pngChunk(fp, "IHDR", ihdr);
+    pngChunk(fp, "IDAT", z);
+    pngChunk(fp, "IEND", {});
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
 }
 
-std::vector<PuzzlePiece> generatePieces(int grid)
+void dumpFrame(const char* path)
 {
-    srand((unsigned)time(NULL));
-    std::vector<PuzzlePiece> out;
-    out.reserve(grid * grid);
+    if (softwareBackend) {
+        if (sw.w == WINDOW_W && sw.h == WINDOW_H) writePNG(path, sw.color.data(), sw.w, sw.h);
+        else writePNG(path, resizeImage(sw.color.data(), sw.w, sw.h, WINDOW_W, WINDOW_H).data(), WINDOW_W, WINDOW_H);
+        return;
+    }
+    std::vector<uint8_t> pixels((size_t)WINDOW_W * WINDOW_H * 4);
+    std::vector<uint8_t> flipped(pixels.size());
+    size_t row = (size_t)WINDOW_W * 4;
+    glsBindFramebuffer(screenFbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, WINDOW_W, WINDOW_H, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    for (int y = 0; y < WINDOW_H; ++y)
+        memcpy(&flipped[(size_t)y * row], &pixels[(size_t)(WINDOW_H - 1 - y) * row], row);
+    writePNG(path, flipped.data(), WINDOW_W, WINDOW_H);
+}
 
-    float half = 0.5f / grid;
-    float cell = 2.0f * half;
+// headless runs without --image use a generated picture, written once to the cache
+std::string proceduralImage()
+{
+    std::string dir = cacheDir();
+    if (dir.empty()) return "";
+    std::string path = dir + "/bench-2048.ppm";
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) return path;
 
-    for (int row = 0; row < grid; ++row) {
-        for (int col = 0; col < grid; ++col) {
-            PuzzlePiece p;
+    const int size = 2048;
+    std::vector<uint8_t> rgb((size_t)size * size * 3);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            uint8_t* p = &rgb[((size_t)y * size + x) * 3];
+            bool check = ((x >> 6) ^ (y >> 6)) & 1;
+            p[0] = (uint8_t)(x * 255 / size);
+            p[1] = (uint8_t)(y * 255 / size);
+            p[2] = check ? 200 : 60;
+        }
+    }
+    std::string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) return "";
+    fprintf(fp, "P6\n%d %d\n255\n", size, size);
+    bool ok = fwrite(rgb.data(), 1, rgb.size(), fp) == rgb.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return "";
+    }
+    return path;
+}
 
-			//TODO picture is upside down need to flip it again
-			stbi_set_flip_vertically_on_load(1);
-            float u_left   = col / float(grid);
-            float u_right  = (col + 1) / float(grid);
-            float v_top    = row / float(grid);
-            float v_bottom = (row + 1) / float(grid);
+// renders `frames` frames into screenFbo and reports frame time percentiles;
+// each frame is timed through glFinish so the GPU (or llvmpipe) work counts
+void runHeadless(int frames, const char* dump)
+{
+    // finish streaming the picture and the first page requests before timing
+    while (upload.pixels) textureUploadStep();
+    for (int i = 0; i < 100; ++i) {
+        renderBoard(liveView());
+        if (!softwareBackend) glFinish();
+        if (i >= 2 && !vt.inflight) break;
+    }
 
-            p.u0 = u_left;
-            p.u1 = u_right;
-			//NOTE changing v_top to v_bottom fixs the above issue, however Y positions of top and bot change places
-            p.v0 = 1.0f - v_top;
-            p.v1 = 1.0f - v_bottom;
+    bool dumpEach = dump && strstr(dump, "%d");
+    std::vector<double> times;
+    times.reserve(frames);
+    for (int f = 0; f < frames; ++f) {
+        double t0 = now();
+        renderBoard(liveView());
+        if (!softwareBackend) glFinish();
+        times.push_back((now() - t0) * 1000.0);
+        framesRendered++;
+        profFrameEnd();
+        if (dumpEach) {
+            char path[1024];
+            snprintf(path, sizeof(path), dump, f);
+            dumpFrame(path);
+        }
+    }
+    if (dump && !dumpEach) dumpFrame(dump);
+    if (times.empty()) return;
 
-            p.size = half;
+    std::sort(times.begin(), times.end());
+    auto pct = [&](double q) { return times[std::min(times.size() - 1, (size_t)(q * times.size()))]; };
+    printf("bench-render: %-8s grid %4d %7zu pieces %5d frames  p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f ms  %7.1f fps\n",
+           softwareBackend ? "software" : "gl", GRID, pieces.size(), frames, pct(0.50), pct(0.90), pct(0.99), times.back(), 1000.0 / pct(0.50));
+}
 
-            p.tx = ((col + 0.5f) - grid / 2.0f) * cell;
-            p.ty = ((row + 0.5f) - grid / 2.0f) * cell;
+// swaps with the profiler around it; frames drawn while dragging record how
+// old their cursor sample is by the time the swap returns
+void presentFrame(GLFWwindow* window, double loadStart)
+{
+    {
+        ProfileScope scope(PROF_SWAP);
+        profGpuBegin(PROF_GPU_SWAP);
+        glfwSwapBuffers(window);
+        profGpuEnd();
+    }
+    if (view.dragged != -1) latencyAdd(dragLatency, (now() - dragSampleTime) * 1000.0);
+    framesRendered++;
+    profFrameEnd();
+    if (framesRendered == 1)
+        printf("first frame: %.1f ms after loading started\n", (now() - loadStart) * 1000.0);
+}
 
-            p.x = ((rand() % 2000) / 1000.0f - 1.0f) * 0.85f;
-            p.y = ((rand() % 2000) / 1000.0f - 1.0f) * 0.85f;
+// main thread: copy the board into the back slot and hand it over
+void publishSnapshot()
+{
+    double t0 = now();
+    BoardSnapshot &b = snapshots.slots[snapshots.back];
+    b.pieces = pieces;
+    // a slot that was never drawn still holds its rects
+    for (const MapRect &r : b.dirty) minimapMarkRect(r);
+    b.dirty.clear();
+    b.dirty.swap(mapDirty);
+    b.view = liveView();
+    b.view.pieces = &b.pieces;
+    b.view.dirty = &b.dirty;
+    b.published = now();
+    snapshots.back = snapshots.shared.exchange(snapshots.back | SNAPSHOT_NEW) & ~SNAPSHOT_NEW;
+    snapshots.published++;
+    snapshots.publishSeconds += now() - t0;
+}
 
-            p.snapped = false;
-            out.push_back(p);
+// render thread: take the newest snapshot if there is one; false keeps the
+// current front slot
+bool acquireSnapshot()
+{
+    if (!(snapshots.shared.load() & SNAPSHOT_NEW)) return false;
+    double t0 = now();
+    snapshots.front = snapshots.shared.exchange(snapshots.front) & ~SNAPSHOT_NEW;
+    snapshots.acquired++;
+    snapshots.ready = true;
+    double t = now();
+    snapshots.acquireSeconds += t - t0;
+    snapshots.ageSeconds += t - snapshots.slots[snapshots.front].published;
+    return true;
+}
+
+void renderThreadMain(GLFWwindow* window, double loadStart)
+{
+    glfwMakeContextCurrent(window);
+    while (!rendererQuit) {
+        bool fresh = acquireSnapshot();
+        bool busy = upload.pixels || vt.inflight;
+        if (!snapshots.ready || (onDemand && !fresh && !busy)) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(SIM_TICK));
+            continue;
+        }
+        if (upload.pixels) {
+            ProfileScope scope(PROF_UPLOAD);
+            textureUploadStep();
         }
+        {
+            ProfileScope scope(PROF_RENDER);
+            renderBoard(snapshots.slots[snapshots.front].view);
+        }
+        presentFrame(window, loadStart);
+        paceFrame();
     }
-    return out;
+    glfwMakeContextCurrent(NULL);
 }
 
-int bringFront(int idx)
+void startRenderer(GLFWwindow* window, double loadStart)
 {
-    if (idx < 0 || idx >= (int)pieces.size()) return idx;
-    PuzzlePiece p = pieces[idx];
-    pieces.erase(pieces.begin() + idx);
-    pieces.push_back(p);
-    return (int)pieces.size() - 1;
+    glfwMakeContextCurrent(NULL);
+    rendererQuit = false;
+    needsRedraw = true;
+    renderer = std::thread(renderThreadMain, window, loadStart);
 }
 
-int main()
+void stopRenderer(GLFWwindow* window)
 {
+    rendererQuit = true;
+    renderer.join();
+    glfwMakeContextCurrent(window);
+}
+
+void printSnapshotStats()
+{
+    if (snapshots.published == 0) return;
+    printf("snapshots: %lu published, %lu drawn, %lu dropped; publish %.3f ms (%.1f KB), acquire %.4f ms, "
+           "%.2f ms from publish to draw\n",
+           snapshots.published, snapshots.acquired, snapshots.published - snapshots.acquired,
+           snapshots.publishSeconds * 1000.0 / snapshots.published, pieces.size() * sizeof(PuzzlePiece) / 1024.0,
+           snapshots.acquired ? snapshots.acquireSeconds * 1000.0 / snapshots.acquired : 0.0,
+           snapshots.acquired ? snapshots.ageSeconds * 1000.0 / snapshots.acquired : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    bool streamOrphan = false;
+    const char* imagePath = NULL;
+    std::vector<const char*> imagePaths;
+    const char* dumpPath = NULL;
+    int headlessFrames = BENCH_FRAMES;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--stream-orphan")) streamOrphan = true;
+        else if (!strcmp(argv[i], "--on-demand")) onDemand = true;
+        else if (!strcmp(argv[i], "--sync-upload")) syncUpload = true;
+        else if (!strcmp(argv[i], "--cpu-mips")) cpuMips = true;
+        else if (!strcmp(argv[i], "--compress=bc1")) compression = COMPRESS_BC1;
+        else if (!strcmp(argv[i], "--compress=bc7")) compression = COMPRESS_BC7;
+        else if (!strcmp(argv[i], "--virtual")) virtualTexture = true;
+        else if (!strncmp(argv[i], "--max-texture=", 14)) maxTextureSize = atoi(argv[i] + 14);
+        else if (!strcmp(argv[i], "--headless")) headless = true;
+        else if (!strncmp(argv[i], "--image=", 8)) imagePaths.push_back(argv[i] + 8);
+        else if (!strncmp(argv[i], "--boards=", 9)) boardCount = std::max(1, atoi(argv[i] + 9));
+        else if (!strncmp(argv[i], "--grid=", 7)) GRID = std::max(1, atoi(argv[i] + 7));
+        else if (!strncmp(argv[i], "--frames=", 9)) headlessFrames = std::max(0, atoi(argv[i] + 9));
+        else if (!strncmp(argv[i], "--dump=", 7)) dumpPath = argv[i] + 7;
+        else if (!strcmp(argv[i], "--profile-json")) profiler.json = true;
+        else if (!strcmp(argv[i], "--low-latency")) lowLatency = true;
+        else if (!strcmp(argv[i], "--frame-delay")) frameDelay = true;
+        else if (!strcmp(argv[i], "--render-thread")) renderThread = true;
+        else if (!strcmp(argv[i], "--mesh-pieces")) meshPieces = true;
+        else if (!strcmp(argv[i], "--minimap")) minimapEnabled = true;
+        else if (!strcmp(argv[i], "--damage")) damageTracking = true;
+        else if (!strcmp(argv[i], "--software")) softwareBackend = true;
+        else if (!strncmp(argv[i], "--dynamic-res=", 14)) {
+            dynres.target = (float)atof(argv[i] + 14);
+            dynres.level = DYNRES_STEPS;
+        }
+        else if (!strcmp(argv[i], "--vsync=on")) vsync = VSYNC_ON;
+        else if (!strcmp(argv[i], "--vsync=off")) vsync = VSYNC_OFF;
+        else if (!strcmp(argv[i], "--vsync=adaptive")) vsync = VSYNC_ADAPTIVE;
+        else if (!strncmp(argv[i], "--fps-cap=", 10)) {
+            double fps = atof(argv[i] + 10);
+            pacer.interval = fps > 0.0 ? 1.0 / fps : 0.0;
+        }
+    }
+    if (!imagePaths.empty()) imagePath = imagePaths[0];
+    if (boardCount > 1 && meshPieces) {
+        // mesh ids and their table are per board
+        fprintf(stderr, "boards: --mesh-pieces needs a single board, using masks\n");
+        meshPieces = false;
+    }
+    if (minimapEnabled && meshPieces) {
+        // meshes are picked and drawn for the camera's view only
+        fprintf(stderr, "minimap: not supported with --mesh-pieces\n");
+        minimapEnabled = false;
+    }
+    if (dynres.target > 0.0f && meshPieces) {
+        // a multisampled window can't take a stretching blit
+        fprintf(stderr, "dynamic-res: not supported with --mesh-pieces\n");
+        dynres.target = 0.0f;
+    }
+    if (dynres.target > 0.0f && damageTracking) {
+        // the stretched board covers the whole window every frame
+        fprintf(stderr, "damage: not supported with --dynamic-res\n");
+        damageTracking = false;
+    }
+
+    GLFWwindow* window = NULL;
+    if (headless) {
+        if (!softwareBackend && !createHeadlessContext()) {
+            fprintf(stderr, "headless: no GL context, using the software renderer\n");
+            softwareBackend = true;
+        }
+    } else {
 #ifdef __APPLE__
-    glfwInitHint(GLFW_COCOA_CHDIR_RESOURCES, GLFW_FALSE);
+        glfwInitHint(GLFW_COCOA_CHDIR_RESOURCES, GLFW_FALSE);
 #endif
 
-    if (!glfwInit()) return -1;
+        if (!glfwInit()) return -1;
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR,4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR,1);
-    glfwWindowHint(GLFW_OPENGL_PROFILE,GLFW_OPENGL_CORE_PROFILE);
+        if (!softwareBackend) {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR,4);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR,1);
+            glfwWindowHint(GLFW_OPENGL_PROFILE,GLFW_OPENGL_CORE_PROFILE);
 #if __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+            glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
+            // mesh outlines have no coverage of their own
+            if (meshPieces) glfwWindowHint(GLFW_SAMPLES, 4);
+            glfwWindowHint(GLFW_DEPTH_BITS, 24);
 
-    GLFWwindow* window = glfwCreateWindow(WINDOW_W, WINDOW_H, "jigsaw", NULL, NULL);
-    if (!window) return -1;
+            window = glfwCreateWindow(WINDOW_W, WINDOW_H, "jigsaw", NULL, NULL);
+            if (!window) fprintf(stderr, "gl: no OpenGL 4.1 context, using the software renderer\n");
+        }
+        if (!window) {
+            // the software renderer only blits, which any 3.0 context can do
+            softwareBackend = true;
+            glfwDefaultWindowHints();
+#if __APPLE__
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR,3);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR,2);
+            glfwWindowHint(GLFW_OPENGL_PROFILE,GLFW_OPENGL_CORE_PROFILE);
+            glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+            window = glfwCreateWindow(WINDOW_W, WINDOW_H, "jigsaw", NULL, NULL);
+            if (!window) return -1;
+        }
 
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+        glfwMakeContextCurrent(window);
+        applySwapInterval();
+
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        glfwSetWindowRefreshCallback(window, window_refresh_callback);
+        glfwSetWindowFocusCallback(window, window_focus_callback);
+        glfwSetWindowIconifyCallback(window, window_iconify_callback);
+        glfwSetCursorPosCallback(window, cursor_pos_callback);
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+        glfwSetScrollCallback(window, scroll_callback);
+    }
 
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    if (softwareBackend) {
+        if (meshPieces || virtualTexture || compression != COMPRESS_NONE || boardCount > 1 || minimapEnabled ||
+            damageTracking || renderThread)
+            fprintf(stderr, "software: --mesh-pieces, --virtual, --compress, --boards, --minimap, --damage and "
+                            "--render-thread need GL, ignoring them\n");
+        meshPieces = virtualTexture = minimapEnabled = damageTracking = renderThread = false;
+        compression = COMPRESS_NONE;
+        boardCount = 1;
+        imagePaths.resize(std::min(imagePaths.size(), (size_t)1));
+    }
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+    // a headless software run has no context at all
+    if ((window || !softwareBackend) && !gladLoadGLLoader((GLADloadproc)glProc)) {
         fprintf(stderr, "Failed to init GLAD\n");
         return -1;
     }
 
-    printf("OpenGL: %s\n", glGetString(GL_VERSION));
-
-    const char* filters[] = {"*.jpg", "*.png"};
-    const char* chosen = tinyfd_openFileDialog("Choose image for puzzle", "", 2, filters, NULL, 0);
-    if (!chosen) return 0;
-
-    int imgW = 0, imgH = 0;
-    tex = loadTexture(chosen, imgW, imgH);
-    if (!tex) return 0;
-
-    pieces = generatePieces(GRID);
+    if (window || !softwareBackend) printf("OpenGL: %s\n", glGetString(GL_VERSION));
+    if (softwareBackend) {
+        if (window && !glBlitFramebuffer) {
+            fprintf(stderr, "software: this OpenGL can't blit a frame to the window\n");
+            return -1;
+        }
+        printf("software: rasterizing on the CPU, %dx%d %s\n", WINDOW_W, WINDOW_H,
+               headless ? "in memory" : "blitted to the window");
+    } else if (headless) {
+        printf("headless: %s, %dx%d offscreen\n", glGetString(GL_RENDERER), WINDOW_W, WINDOW_H);
+        if (!createScreenTarget()) return -1;
+    }
 
-    float quad[16] = {
-        -0.5f, -0.5f, 0.0f, 0.0f,
-		0.5f, -0.5f, 1.0f, 0.0f,
-		0.5f,  0.5f, 1.0f, 1.0f,
-        -0.5f,  0.5f, 0.0f, 1.0f
-    };
-    unsigned int idx[] = {0,1,2, 2,3,0};
+    if (!softwareBackend && hasGLExtension("GL_ARB_texture_storage"))
+        texStorage2D = (PFNGLTEXSTORAGE2DPROC)glProc("glTexStorage2D");
 
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
+    if (!softwareBackend) {
+        // the tiles (or the picture array), the mask atlas and the board layer
+        GLint fragmentUnits = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &fragmentUnits);
+        int needed = boardCount > 1 ? 3 : TILE_UNITS + 2;
+        if (fragmentUnits < needed) {
+            fprintf(stderr, "gl: %d fragment texture units, the piece shader needs %d\n", fragmentUnits, needed);
+            return -1;
+        }
+        const char* renderer = (const char*)glGetString(GL_RENDERER);
+        if (dynres.target > 0.0f && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe") ||
+                                     strstr(renderer, "SwiftShader") || strstr(renderer, "Software"))) {
+            printf("dynamic-res: %s rasterizes on the CPU, frames are timed through glFinish\n", renderer);
+            dynres.cpuTimed = true;
+        }
+    }
 
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(idx), idx, GL_STATIC_DRAW);
+    std::string generated;
+    const char* chosen = imagePath;
+    if (!chosen && headless) {
+        generated = proceduralImage();
+        if (generated.empty()) {
+            fprintf(stderr, "headless: pass --image=PATH (no cache directory for a generated picture)\n");
+            return -1;
+        }
+        chosen = generated.c_str();
+    }
+    if (!chosen) {
+        const char* filters[] = {"*.jpg", "*.png"};
+        chosen = tinyfd_openFileDialog("Choose image for puzzle", "", 2, filters, NULL, 0);
+        if (!chosen) return 0;
+    }
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0,2,GL_FLOAT,GL_FALSE,4*sizeof(float),(void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,4*sizeof(float),(void*)(2*sizeof(float)));
+    int imgW = 0, imgH = 0;
+    double loadStart = now();
+    if (boardCount > 1) {
+        if (imagePaths.empty()) imagePaths.push_back(chosen);
+        if (!loadBoards(imagePaths, boardCount)) return 0;
+        pieces.clear();
+        for (int b = 0; b < boardCount; ++b) {
+            std::vector<PuzzlePiece> board = generatePieces(GRID, b);
+            pieces.insert(pieces.end(), board.begin(), board.end());
+        }
+    } else {
+        if (softwareBackend ? !swLoadPicture(chosen, imgW, imgH) : !loadTexture(chosen, imgW, imgH)) return 0;
+        pieces = generatePieces(GRID);
+    }
 
-    const char* vs =
-        "#version 410 core\n"
-        "layout(location=0) in vec2 pos;\n"
-        "layout(location=1) in vec2 uv;\n"
-        "out vec2 v_uv;\n"
-        "void main(){ v_uv = uv; gl_Position = vec4(pos,0,1); }\n";
+    if (softwareBackend) buildMaskAtlas();
+    else setupRenderer(streamOrphan);
 
-    const char* fs =
-        "#version 410 core\n"
-        "in vec2 v_uv;\n"
-        "out vec4 frag;\n"
-        "uniform sampler2D tex0;\n"
-        "void main(){ frag = texture(tex0, v_uv); }\n";
+    if (headless) {
+        runHeadless(headlessFrames, dumpPath);
+        printStreamStats();
+        printGLStats(framesRendered);
+        printVirtualStats();
+        printMeshStats();
+        printStackStats();
+        printMinimapStats();
+        printDamageStats();
+        printDynamicResStats();
+        printBoardStats(framesRendered);
+        printSoftwareStats();
+        if (softwareBackend) {
+            swShutdown();
+            poolStop();
+            return 0;
+        }
+        shutdownRenderer();
+        glDeleteFramebuffers(1, &screenFbo);
+        glDeleteRenderbuffers(1, &screenColor);
+        glDeleteRenderbuffers(1, &screenDepth);
+        poolStop();
+        vtShutdown();
+        destroyHeadlessContext();
+        return 0;
+    }
 
-    texShader = makeProgram(vs, fs);
+    if (renderThread) startRenderer(window, loadStart);
 
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+        double frameStart = now();
+        if (renderThread) {
+            glfwWaitEventsTimeout(SIM_TICK);
+        } else if (!onDemand) {
+            glfwPollEvents();
+        } else if (windowIconified) {
+            glfwWaitEvents();
+        } else if (!needsRedraw && tweens.count == 0) {
+            glfwWaitEventsTimeout(windowFocused ? IDLE_WAIT : UNFOCUSED_WAIT);
+        } else if (!windowFocused && frameStart - lastRenderTime < UNFOCUSED_FRAME_INTERVAL) {
+            // a throttled frame is due: sleep until then rather than spin
+            glfwWaitEventsTimeout(lastRenderTime + UNFOCUSED_FRAME_INTERVAL - frameStart);
+        } else {
+            glfwPollEvents();
+        }
 
+        double inputStart = now();
         mouseDown = (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS);
         double mx, my;
         glfwGetCursorPos(window, &mx, &my);
-        float xN = (float)((mx / WINDOW_W) * 2.0 - 1.0);
-        float yN = (float)(1.0 - (my / WINDOW_H) * 2.0);
+        cursorTime = now();
+        cursorStamp = cursorTime;
+        cursorX = mx;
+        cursorY = my;
+        float wx, wy;
+        screenToWorld(liveView(), mx, my, wx, wy);
 
         if (mouseDown && !prevMouseDown) {
-            for (int i = (int)pieces.size() - 1; i >= 0; --i) {
+            ProfileScope hitTest(PROF_HIT_TEST);
+            for (int i = 0; i < (int)pieces.size(); ++i) {
                 PuzzlePiece &p = pieces[i];
-                if (p.snapped) continue;
-                if (xN > p.x - p.size && xN < p.x + p.size &&
-                    yN > p.y - p.size && yN < p.y + p.size) {
-                    dragged = bringFront(i);
-                    grabOffsetX = xN - pieces[dragged].x;
-                    grabOffsetY = yN - pieces[dragged].y;
-                    break;
-                }
+                if (p.snapped || (dragged != -1 && p.depth < pieces[dragged].depth)) continue;
+                if (wx > p.x - p.size && wx < p.x + p.size &&
+                    wy > p.y - p.size && wy < p.y + p.size)
+                    dragged = i;
+            }
+            if (dragged != -1) {
+                raisePiece(dragged);
+                minimapMark(pieces[dragged]);
+                tweenCancel(dragged);
+                pickupX = pieces[dragged].x;
+                pickupY = pieces[dragged].y;
+                grabOffsetX = wx - pieces[dragged].x;
+                grabOffsetY = wy - pieces[dragged].y;
+            }
+            // a press on empty board drags the camera instead
+            if (dragged == -1) {
+                panning = true;
+                panAnchorX = wx;
+                panAnchorY = wy;
             }
         }
 
@@ -269,59 +5834,117 @@ int main()
                 float dy = p.y - p.ty;
                 float centerDist = sqrtf(dx*dx + dy*dy);
 
-                float mx_d = xN - p.tx;
-                float my_d = yN - p.ty;
+                float mx_d = wx - p.tx;
+                float my_d = wy - p.ty;
                 float mouseDist = sqrtf(mx_d*mx_d + my_d*my_d);
 
-                float threshold = fmaxf(SNAP_BASE, p.size * SNAP_FACTOR);
+                float threshold = fmaxf(SNAP_BASE / camera.zoom, p.size * SNAP_FACTOR);
 
                 if (centerDist <= threshold || mouseDist <= threshold) {
-                    p.x = p.tx;
-                    p.y = p.ty;
-                    p.snapped = true;
+                    tweenStart(dragged, p.tx, p.ty, SNAP_TIME, TWEEN_SNAP);
+                } else if (fabsf(p.x - camera.x) > 1.0f / camera.zoom || fabsf(p.y - camera.y) > 1.0f / camera.zoom) {
+                    // dropped out of view
+                    tweenStart(dragged, pickupX, pickupY, RETURN_TIME, TWEEN_MOVE);
                 }
             }
             dragged = -1;
+            panning = false;
         }
 
         if (mouseDown && dragged != -1) {
-            pieces[dragged].x = xN - grabOffsetX;
-            pieces[dragged].y = yN - grabOffsetY;
+            float nx = wx - grabOffsetX;
+            float ny = wy - grabOffsetY;
+            if (nx != pieces[dragged].x || ny != pieces[dragged].y) {
+                needsRedraw = true;
+                minimapMark(pieces[dragged]);
+                pieces[dragged].x = nx;
+                pieces[dragged].y = ny;
+                minimapMark(pieces[dragged]);
+            }
+        }
+
+        if (mouseDown && panning && (wx != panAnchorX || wy != panAnchorY)) {
+            camera.x += panAnchorX - wx;
+            camera.y += panAnchorY - wy;
+            cameraMoved();
         }
 
+        if (scatterRequested) {
+            scatterRequested = false;
+            scatterPieces();
+        }
+        if (tweenAdvance(now())) needsRedraw = true;
+
         prevMouseDown = mouseDown;
+        profAdd(PROF_INPUT, inputStart);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+        if (benchRequested) {
+            benchRequested = false;
+            // the benchmark replaces the board, so it runs with the context back here
+            if (renderThread) stopRenderer(window);
+            runScalingBenchmark(window);
+            if (renderThread) startRenderer(window, loadStart);
+        }
 
-        glUseProgram(texShader);
-        glBindVertexArray(vao);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tex);
-        GLint texloc = glGetUniformLocation(texShader, "tex0");
-        glUniform1i(texloc, 0);
-
-        for (auto &p : pieces) {
-            float verts[16] = {
-                p.x - p.size, p.y - p.size,  p.u0, p.v0,
-                p.x + p.size, p.y - p.size,  p.u1, p.v0,
-                p.x + p.size, p.y + p.size,  p.u1, p.v1,
-                p.x - p.size, p.y + p.size,  p.u0, p.v1
-            };
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(verts), verts);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        if (renderThread) {
+            if (needsRedraw) publishSnapshot();
+            needsRedraw = false;
+            continue;
         }
 
-        glfwSwapBuffers(window);
+        if (upload.pixels) {
+            ProfileScope scope(PROF_UPLOAD);
+            textureUploadStep();
+            needsRedraw = true;
+        }
+        if (vt.inflight) needsRedraw = true;
+
+        if (onDemand) {
+            double t = now();
+            bool throttled = !windowFocused && t - lastRenderTime < UNFOCUSED_FRAME_INTERVAL;
+            if (!needsRedraw || windowIconified || throttled) {
+                framesSkipped++;
+                continue;
+            }
+            lastRenderTime = t;
+        }
+        needsRedraw = false;
+
+        {
+            ProfileScope scope(PROF_RENDER);
+            renderBoard(liveView());
+        }
+
+        double swapStart = now();
+        presentFrame(window, loadStart);
+        paceFrame();
+        if (frameDelay && !onDemand && pacer.interval == 0.0) frameDelaySleep(frameStart, swapStart);
     }
 
-    if (tex) glDeleteTextures(1, &tex);
-    glDeleteProgram(texShader);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &ebo);
-    glDeleteVertexArrays(1, &vao);
+    if (renderThread) {
+        stopRenderer(window);
+        printSnapshotStats();
+    }
+    printStreamStats();
+    printf("frames: %lu rendered, %lu skipped, %.1f pieces culled per frame\n", framesRendered, framesSkipped,
+           framesRendered ? (double)piecesCulled / framesRendered : 0.0);
+    printGLStats(framesRendered);
+    printVirtualStats();
+    printMeshStats();
+    printStackStats();
+    printMinimapStats();
+    printDamageStats();
+    printDynamicResStats();
+    printBoardStats(framesRendered);
+    printSoftwareStats();
+    printTweenStats();
+    printLatencyStats();
+    printPacingStats();
 
+    if (softwareBackend) swShutdown();
+    else shutdownRenderer();
+    poolStop();
+    vtShutdown();
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;